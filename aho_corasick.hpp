@@ -0,0 +1,156 @@
+// Copyright 2019 AndreevSemen
+
+#ifndef INCLUDE_AHO_CORASICK_HPP_
+#define INCLUDE_AHO_CORASICK_HPP_
+
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+#include "trie.hpp"
+
+// Multi-pattern matcher over the keys of a trie. Goto transitions are
+// the trie's own child tables; on top of them every node gets a failure
+// link to the node of its longest proper suffix and an output link to
+// the nearest such suffix that holds a value, so a text is matched
+// against all keys in one pass. The automaton refers to the trie it was
+// built from and, like an iterator, is invalidated by changing it.
+template <class T, class KeyType = wchar_t,
+          class Allocator = std::allocator<T>>
+class aho_corasick
+{
+private:
+    typedef trie<T, KeyType, Allocator> source_type;
+    typedef std::basic_string_view<KeyType> key_view;
+    typedef uint32_t node_id;
+
+    static constexpr node_id no_node = source_type::no_node;
+    static constexpr node_id top_id = source_type::top_id;
+
+    // Indexed by node id; released nodes keep unused entries
+    struct node_links {
+        node_id fail_ = top_id;
+        node_id output_ = no_node;
+        uint32_t depth_ = 0;
+#ifdef TRIE_NO_PARENT_LINKS
+        node_id parent_ = no_node;
+#endif
+    };
+
+    const source_type* trie_;
+    std::vector<node_links> links_;
+
+    // The end marker is not a transition
+    node_id child(node_id state, KeyType key_char) const {
+        auto next = trie_->nodes_[state].children_.find(key_char);
+
+        return next == source_type::end_id ? no_node : next;
+    }
+
+    bool has_value(node_id state) const {
+        return trie_->nodes_[state].value_ != no_node;
+    }
+
+public:
+    typedef typename source_type::const_iterator const_iterator;
+    typedef node_id state_type;
+
+    // Links are set breadth-first, so a node's failure target is always
+    // done before the node itself
+    explicit aho_corasick(const source_type& source)
+      : trie_(&source)
+    {
+        // Only a moved-from source lacks the root the links start from
+        if (source.nodes_.empty()) {
+            return;
+        }
+
+        links_.resize(source.nodes_.size());
+
+        std::vector<node_id> order{top_id};
+        for (size_t head = 0; head < order.size(); ++head) {
+            auto node = order[head];
+
+            source.nodes_[node].children_.for_each([&](node_id next) {
+                if (next == source_type::end_id) {
+                    return;
+                }
+
+                auto key_char = source.nodes_[next].key_;
+                auto& links = links_[next];
+                links.depth_ = links_[node].depth_ + 1;
+#ifdef TRIE_NO_PARENT_LINKS
+                links.parent_ = node;
+#endif
+
+                if (node != top_id) {
+                    auto fail = links_[node].fail_;
+                    while (fail != top_id &&
+                           child(fail, key_char) == no_node) {
+                        fail = links_[fail].fail_;
+                    }
+
+                    auto target = child(fail, key_char);
+                    links.fail_ = target == no_node ? top_id : target;
+                }
+
+                links.output_ = has_value(links.fail_)
+                                    ? links.fail_
+                                    : links_[links.fail_].output_;
+                order.push_back(next);
+            });
+        }
+    }
+
+    state_type initial_state() const {
+        return top_id;
+    }
+
+    // Calls func(position, iter) for every occurrence of a key in text,
+    // where position is where the occurrence starts, counting offset
+    // for the text before. Occurrences are reported as they end, the
+    // longest first among those ending together. A long text can be fed
+    // in pieces by passing the returned state and the count of chars
+    // fed so far to the next call.
+    template <class Function>
+    state_type scan(key_view text, Function func,
+                    state_type state = top_id, size_t offset = 0) const {
+        if (links_.empty()) {
+            return state;
+        }
+
+        for (size_t i = 0; i < text.size(); ++i) {
+            auto next = child(state, text[i]);
+
+            while (next == no_node && state != top_id) {
+                state = links_[state].fail_;
+                next = child(state, text[i]);
+            }
+            state = next == no_node ? top_id : next;
+
+            auto match = has_value(state) ? state : links_[state].output_;
+            for (; match != no_node; match = links_[match].output_) {
+                func(offset + i + 1 - links_[match].depth_,
+                     iterator_to(match));
+            }
+        }
+
+        return state;
+    }
+
+private:
+    const_iterator iterator_to(node_id id) const {
+#ifdef TRIE_NO_PARENT_LINKS
+        return trie_->iterator_to(id, [this](node_id node) {
+            return links_[node].parent_;
+        });
+#else
+        return trie_->iterator_to(id, [](node_id node) {
+            return node;
+        });
+#endif
+    }
+};
+
+#endif // INCLUDE_AHO_CORASICK_HPP_
@@ -0,0 +1,484 @@
+// Copyright 2019 AndreevSemen
+
+#ifndef INCLUDE_DAWG_HPP_
+#define INCLUDE_DAWG_HPP_
+
+#include <algorithm>
+#include <functional>
+#include <string>
+#include <vector>
+#include <utility>
+#include <exception>
+#include <stdexcept>
+#include <limits>
+#include <cstdint>
+#include <type_traits>
+#include <unordered_set>
+
+#include "trie.hpp"
+
+// Minimal acyclic automaton over a fixed key set. Keys sharing a suffix
+// share the states that spell it, so the graph is usually several times
+// smaller than the trie it was built from. Since a state no longer has a
+// single key leading to it, values are kept in a dense array indexed by
+// the key's rank in sorted order: every edge carries the number of keys
+// that sort before the ones reached through it, and find adds those up
+// on the way down.
+template <class T, class KeyType = wchar_t>
+class dawg
+{
+private:
+    typedef std::basic_string<KeyType> key_string;
+    typedef uint32_t state_type;
+
+    static constexpr state_type root = 0;
+    static constexpr state_type no_state =
+        std::numeric_limits<state_type>::max();
+
+    // Byte-key states with at least direct_min edges get a slot for every
+    // byte, so find indexes them instead of searching. Slots without an
+    // edge have no target and the rank of the next edge.
+    static constexpr size_t direct_slots = 256;
+    static constexpr size_t direct_min = 16;
+    // Longer edge lists are binary searched
+    static constexpr size_t scan_max = 16;
+
+    // Label, target and rank share a record, so a step of find reads one
+    // place per edge
+    struct dawg_edge {
+        KeyType label_;
+        state_type target_;
+        uint32_t rank_;
+    };
+
+    // A sentinel after the last state closes its edge range
+    struct dawg_state {
+        uint32_t first_edge_;
+        bool final_;
+    };
+
+    // Maps a byte key onto its slot keeping the order of KeyType values
+    static size_t slot_of(KeyType key_char) {
+        constexpr uint8_t sign_flip = std::is_signed<KeyType>::value ? 0x80 : 0;
+
+        return static_cast<uint8_t>(key_char) ^ sign_flip;
+    }
+
+    // Incremental construction from keys in sorted order (Daciuk et al.).
+    // Only the path of the last key is mutable; whenever the next key
+    // leaves that path, the abandoned tail is folded into the register of
+    // already minimal states.
+    class builder {
+    private:
+        struct build_state {
+            std::vector<std::pair<KeyType, state_type>> edges_;
+            bool final_ = false;
+            uint32_t count_ = 0;
+        };
+
+        struct state_hash {
+            const builder* owner_;
+
+            size_t operator()(state_type id) const {
+                const auto& state = owner_->states_[id];
+                size_t seed = state.final_;
+
+                for (const auto& edge : state.edges_) {
+                    seed = seed * 1000003u ^ std::hash<KeyType>{}(edge.first);
+                    seed = seed * 1000003u ^ edge.second;
+                }
+
+                return seed;
+            }
+        };
+
+        struct state_equal {
+            const builder* owner_;
+
+            bool operator()(state_type lhs, state_type rhs) const {
+                const auto& left = owner_->states_[lhs];
+                const auto& right = owner_->states_[rhs];
+
+                return left.final_ == right.final_ &&
+                       left.edges_ == right.edges_;
+            }
+        };
+
+        std::vector<build_state> states_;
+        std::vector<state_type> free_ids_;
+        std::unordered_set<state_type, state_hash, state_equal> register_;
+        std::vector<state_type> path_;
+        key_string previous_;
+
+        state_type new_state() {
+            if (!free_ids_.empty()) {
+                auto id = free_ids_.back();
+                free_ids_.pop_back();
+                return id;
+            }
+
+            states_.emplace_back();
+            return static_cast<state_type>(states_.size() - 1);
+        }
+
+        void release(state_type id) {
+            states_[id] = build_state{};
+            free_ids_.push_back(id);
+        }
+
+        void count_keys(state_type id) {
+            auto& state = states_[id];
+            state.count_ = state.final_;
+
+            for (const auto& edge : state.edges_) {
+                state.count_ += states_[edge.second].count_;
+            }
+        }
+
+        // Freezes the last key's path below depth
+        void minimize(size_t depth) {
+            while (path_.size() > depth + 1) {
+                auto child = path_.back();
+                path_.pop_back();
+
+                count_keys(child);
+
+                auto found = register_.find(child);
+                if (found != register_.end()) {
+                    states_[path_.back()].edges_.back().second = *found;
+                    release(child);
+                } else {
+                    register_.insert(child);
+                }
+            }
+        }
+
+    public:
+        builder()
+          : register_(0, state_hash{this}, state_equal{this})
+        {
+            path_.push_back(new_state());
+        }
+        builder(const builder&) = delete;
+        builder& operator=(const builder&) = delete;
+
+        void add(const key_string& key) {
+            if (key.empty()) {
+                throw std::out_of_range{
+                    "Empty key couldn't be added"
+                };
+            }
+            if (!previous_.empty() &&
+                !std::lexicographical_compare(previous_.begin(),
+                                              previous_.end(),
+                                              key.begin(), key.end())) {
+                throw std::invalid_argument{
+                    "Keys must be sorted and unique"
+                };
+            }
+
+            auto common = std::mismatch(previous_.begin(), previous_.end(),
+                                        key.begin(), key.end());
+            size_t depth = common.first - previous_.begin();
+
+            minimize(depth);
+
+            for (size_t i = depth; i < key.size(); ++i) {
+                auto id = new_state();
+                states_[path_.back()].edges_.emplace_back(key[i], id);
+                path_.push_back(id);
+            }
+            states_[path_.back()].final_ = true;
+
+            previous_ = key;
+        }
+
+        void finish(dawg& target) {
+            minimize(0);
+            count_keys(root);
+
+            // Renumber reachable states breadth-first into flat arrays
+            constexpr auto unnumbered = std::numeric_limits<state_type>::max();
+            std::vector<state_type> number(states_.size(), unnumbered);
+            std::vector<state_type> order{root};
+            number[root] = 0;
+
+            for (size_t head = 0; head < order.size(); ++head) {
+                for (const auto& edge : states_[order[head]].edges_) {
+                    if (number[edge.second] == unnumbered) {
+                        number[edge.second] =
+                            static_cast<state_type>(order.size());
+                        order.push_back(edge.second);
+                    }
+                }
+            }
+
+            target.states_.clear();
+            target.edges_.clear();
+            target.edge_count_ = 0;
+
+            for (auto id : order) {
+                const auto& state = states_[id];
+                auto first = static_cast<uint32_t>(target.edges_.size());
+                uint32_t rank = state.final_;
+
+                target.states_.push_back({first, state.final_});
+                target.edge_count_ += state.edges_.size();
+
+                if (sizeof(KeyType) == 1 &&
+                    state.edges_.size() >= direct_min) {
+                    target.edges_.resize(first + direct_slots,
+                                         {KeyType{}, no_state, 0});
+
+                    size_t slot = 0;
+                    for (const auto& edge : state.edges_) {
+                        for (; slot < slot_of(edge.first); ++slot) {
+                            target.edges_[first + slot].rank_ = rank;
+                        }
+                        target.edges_[first + slot++] =
+                            {edge.first, number[edge.second], rank};
+                        rank += states_[edge.second].count_;
+                    }
+                    for (; slot < direct_slots; ++slot) {
+                        target.edges_[first + slot].rank_ = rank;
+                    }
+                    continue;
+                }
+
+                for (const auto& edge : state.edges_) {
+                    target.edges_.push_back(
+                        {edge.first, number[edge.second], rank}
+                    );
+                    rank += states_[edge.second].count_;
+                }
+            }
+            target.states_.push_back(
+                {static_cast<uint32_t>(target.edges_.size()), false}
+            );
+        }
+    };
+
+    std::vector<dawg_state> states_;
+    std::vector<dawg_edge> edges_;
+    size_t edge_count_ = 0;
+    std::vector<T> values_;
+
+    // Edge index leaving state on key_char, or npos
+    size_t edge(state_type state, KeyType key_char) const {
+        size_t first = states_[state].first_edge_;
+        size_t count = states_[state + 1].first_edge_ - first;
+        auto edges = edges_.data() + first;
+
+        if constexpr (sizeof(KeyType) == 1) {
+            if (count == direct_slots) {
+                size_t slot = slot_of(key_char);
+
+                return edges[slot].target_ == no_state ? key_string::npos
+                                                       : first + slot;
+            }
+        }
+
+        if (count <= scan_max) {
+            for (size_t i = 0; i < count; ++i) {
+                if (edges[i].label_ == key_char) {
+                    return first + i;
+                }
+            }
+
+            return key_string::npos;
+        }
+
+        auto found = std::lower_bound(
+            edges, edges + count, key_char,
+            [](const dawg_edge& edge, KeyType key) {
+                return edge.label_ < key;
+            }
+        );
+
+        return found != edges + count && found->label_ == key_char
+             ? first + (found - edges)
+             : key_string::npos;
+    }
+
+    key_string key_at(size_t rank) const {
+        key_string key_str;
+        state_type state = root;
+
+        while (!(states_[state].final_ && rank == 0)) {
+            auto first = edges_.begin() + states_[state].first_edge_;
+            auto last = edges_.begin() + states_[state + 1].first_edge_;
+            auto found = std::upper_bound(
+                first, last, rank,
+                [](size_t key_rank, const dawg_edge& edge) {
+                    return key_rank < edge.rank_;
+                }
+            ) - 1;
+
+            rank -= found->rank_;
+            key_str.push_back(found->label_);
+            state = found->target_;
+        }
+
+        return key_str;
+    }
+
+    template <class Source>
+    void add_subtree(builder& build, const Source& source, uint32_t node,
+                     key_string& key) {
+        if (auto value = source.value_of(node)) {
+            build.add(key);
+            values_.push_back(*value);
+        }
+
+        source.nodes_[node].children_.for_each([&](uint32_t child) {
+            if (child != Source::end_id) {
+                key.push_back(source.nodes_[child].key_);
+                add_subtree(build, source, child, key);
+                key.pop_back();
+            }
+        });
+    }
+
+public:
+    struct search_iterator {
+    private:
+        const dawg* dawg_;
+        size_t rank_;
+
+    public:
+        search_iterator(const dawg* owner, size_t rank)
+          : dawg_(owner)
+          , rank_(rank)
+        {}
+
+        const T& value() const {
+            return dawg_->values_[rank_];
+        }
+
+        key_string key() const {
+            return dawg_->key_at(rank_);
+        }
+
+        std::pair<std::basic_string<KeyType>, T> operator*() const {
+            return std::make_pair(key(), value());
+        }
+
+        // Keys are visited in sorted order
+        search_iterator operator++() {
+            if (rank_ == dawg_->size()) {
+                throw std::out_of_range{
+                    "Iterator to end couldn't be incremented"
+                };
+            }
+
+            ++rank_;
+            return *this;
+        }
+        const search_iterator operator++(int) {
+            search_iterator old_state(*this);
+            operator++();
+            return old_state;
+        }
+
+        search_iterator operator--() {
+            if (rank_ == 0) {
+                throw std::out_of_range{
+                    "Begin iterator couldn't be decremented"
+                };
+            }
+
+            --rank_;
+            return *this;
+        }
+        const search_iterator operator--(int) {
+            auto old_state(*this);
+            operator--();
+            return old_state;
+        }
+
+        bool operator==(const search_iterator& rhs) const {
+            return rank_ == rhs.rank_;
+        }
+        bool operator!=(const search_iterator& rhs) const {
+            return rank_ != rhs.rank_;
+        }
+    };
+
+    dawg()
+      : states_{{0, false}, {0, false}}
+    {}
+
+    template <class Allocator>
+    explicit dawg(const trie<T, KeyType, Allocator>& source) {
+        builder build;
+        key_string key;
+
+        values_.reserve(source.size());
+        if (!source.empty()) {
+            add_subtree(build, source, source.top_id, key);
+        }
+        build.finish(*this);
+    }
+
+    // Builds from unique key/value pairs sorted character by character
+    // as KeyType values
+    template <class InputIt>
+    dawg(InputIt first, InputIt last) {
+        builder build;
+
+        for (; first != last; ++first) {
+            build.add(first->first);
+            values_.push_back(first->second);
+        }
+        build.finish(*this);
+    }
+
+    search_iterator begin() const {
+        return search_iterator(this, 0);
+    }
+
+    search_iterator end() const {
+        return search_iterator(this, size());
+    }
+
+    size_t size() const { return values_.size(); }
+    bool empty() const { return values_.empty(); }
+
+    size_t state_count() const { return states_.size() - 1; }
+    size_t edge_count() const { return edge_count_; }
+
+    search_iterator find(const key_string& key) const {
+        state_type state = root;
+        size_t rank = 0;
+
+        for (auto key_char : key) {
+            auto index = edge(state, key_char);
+            if (index == key_string::npos) {
+                return end();
+            }
+
+            rank += edges_[index].rank_;
+            state = edges_[index].target_;
+        }
+
+        if (state == root || !states_[state].final_) {
+            return end();
+        }
+
+        return search_iterator(this, rank);
+    }
+
+    bool get_value(const key_string& key, T& container) const {
+        auto found_iter = find(key);
+
+        if (found_iter == end()) {
+            return false;
+        }
+
+        container = found_iter.value();
+
+        return true;
+    }
+};
+
+#endif // INCLUDE_DAWG_HPP_
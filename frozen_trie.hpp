@@ -0,0 +1,451 @@
+// Copyright 2019 AndreevSemen
+
+#ifndef INCLUDE_FROZEN_TRIE_HPP_
+#define INCLUDE_FROZEN_TRIE_HPP_
+
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <utility>
+#include <exception>
+#include <stdexcept>
+#include <limits>
+#include <cstdint>
+
+#include "trie.hpp"
+
+// Read-only snapshot of a trie in double-array form. Every state s has a
+// BASE and a CHECK cell: the transition on character c goes to
+// t = BASE[s] + code(c) and exists only if CHECK[t] == s, so a lookup
+// costs two array reads per character and follows no pointers.
+// Characters are renumbered densely (code 0 is never used) to keep the
+// arrays compact for wide KeyType.
+template <class T, class KeyType = wchar_t>
+class frozen_trie
+{
+private:
+    typedef std::basic_string<KeyType> key_string;
+    typedef uint32_t state_type;
+
+    static constexpr state_type npos = std::numeric_limits<state_type>::max();
+    static constexpr state_type root = 0;
+    static constexpr int32_t free_cell = -1;
+
+    std::vector<KeyType> alphabet_;
+    std::vector<uint32_t> byte_codes_;
+
+    std::vector<int32_t> base_;
+    std::vector<int32_t> check_;
+    std::vector<uint32_t> value_id_;
+    std::vector<T> values_;
+
+    // Children as a list of codes, so that walking them doesn't try
+    // every code of the alphabet: the first child's code per state and
+    // the next sibling's code per child, 0 when there is none
+    std::vector<uint32_t> first_code_;
+    std::vector<uint32_t> next_code_;
+
+    // Doubly linked ring of unused cells, only alive while building
+    std::vector<int32_t> next_free_;
+    std::vector<int32_t> prev_free_;
+    int32_t free_head_ = free_cell;
+
+    uint32_t code_of(KeyType key_char) const {
+        if constexpr (sizeof(KeyType) == 1) {
+            return byte_codes_[static_cast<uint8_t>(key_char)];
+        } else {
+            size_t pos = trie_detail::find_key(alphabet_.data(),
+                                               alphabet_.size(), key_char);
+            return pos == alphabet_.size() ? 0 : static_cast<uint32_t>(pos + 1);
+        }
+    }
+
+    state_type transition(state_type state, uint32_t code) const {
+        if (code == 0 || base_[state] == 0) {
+            return npos;
+        }
+
+        size_t next = static_cast<size_t>(base_[state]) + code;
+        if (next >= check_.size() ||
+            check_[next] != static_cast<int32_t>(state)) {
+            return npos;
+        }
+
+        return static_cast<state_type>(next);
+    }
+
+    state_type transition(state_type state, KeyType key_char) const {
+        return transition(state, code_of(key_char));
+    }
+
+    state_type first_child(state_type state) const {
+        uint32_t code = first_code_[state];
+
+        return code == 0 ? npos : static_cast<state_type>(base_[state] + code);
+    }
+
+    state_type next_sibling(state_type state) const {
+        uint32_t code = next_code_[state];
+
+        return code == 0 ? npos
+                         : static_cast<state_type>(base_[check_[state]] + code);
+    }
+
+    uint32_t code_into(state_type state) const {
+        return state - static_cast<state_type>(base_[check_[state]]);
+    }
+
+    bool has_value(state_type state) const {
+        return value_id_[state] != npos;
+    }
+
+    state_type descend(const key_string& key) const {
+        state_type state = root;
+
+        for (auto key_char : key) {
+            state = transition(state, key_char);
+            if (state == npos) {
+                return npos;
+            }
+        }
+
+        return state;
+    }
+
+    state_type first_leaf(state_type state) const {
+        while (true) {
+            auto child = first_child(state);
+            if (child == npos) {
+                return state;
+            }
+            state = child;
+        }
+    }
+
+    void link_free(int32_t cell) {
+        if (free_head_ == free_cell) {
+            next_free_[cell] = prev_free_[cell] = cell;
+            free_head_ = cell;
+            return;
+        }
+
+        int32_t tail = prev_free_[free_head_];
+        next_free_[cell] = free_head_;
+        prev_free_[cell] = tail;
+        next_free_[tail] = cell;
+        prev_free_[free_head_] = cell;
+    }
+
+    void unlink_free(int32_t cell) {
+        if (next_free_[cell] == cell) {
+            free_head_ = free_cell;
+        } else {
+            next_free_[prev_free_[cell]] = next_free_[cell];
+            prev_free_[next_free_[cell]] = prev_free_[cell];
+            if (free_head_ == cell) {
+                free_head_ = next_free_[cell];
+            }
+        }
+    }
+
+    void extend(size_t size) {
+        size_t old_size = check_.size();
+        if (size <= old_size) {
+            return;
+        }
+
+        base_.resize(size, 0);
+        check_.resize(size, free_cell);
+        value_id_.resize(size, npos);
+        first_code_.resize(size, 0);
+        next_code_.resize(size, 0);
+        next_free_.resize(size);
+        prev_free_.resize(size);
+
+        for (size_t cell = old_size; cell < size; ++cell) {
+            link_free(static_cast<int32_t>(cell));
+        }
+    }
+
+    bool fits(int32_t base, const std::vector<uint32_t>& codes) const {
+        for (auto code : codes) {
+            size_t cell = static_cast<size_t>(base) + code;
+            if (cell < check_.size() && check_[cell] != free_cell) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    // First base for which every child cell is still free; walks the
+    // free ring and falls back to fresh cells past the end
+    int32_t find_base(const std::vector<uint32_t>& codes) const {
+        if (free_head_ != free_cell) {
+            int32_t cell = free_head_;
+            do {
+                int32_t base = cell - static_cast<int32_t>(codes.front());
+                if (base >= 1 && fits(base, codes)) {
+                    return base;
+                }
+                cell = next_free_[cell];
+            } while (cell != free_head_);
+        }
+
+        return std::max<int32_t>(
+            1, static_cast<int32_t>(check_.size()) -
+               static_cast<int32_t>(codes.front())
+        );
+    }
+
+    template <class Source>
+    void collect_alphabet(const Source& source, uint32_t node,
+                          std::vector<KeyType>& chars) const {
+        source.nodes_[node].children_.for_each([&](uint32_t child) {
+            if (child != Source::end_id) {
+                chars.push_back(source.nodes_[child].key_);
+                collect_alphabet(source, child, chars);
+            }
+        });
+    }
+
+    template <class Source>
+    void place(const Source& source, uint32_t node, state_type state) {
+        const auto& src = source.nodes_[node];
+
+        if (auto value = source.value_of(node)) {
+            value_id_[state] = static_cast<uint32_t>(values_.size());
+            values_.push_back(*value);
+        }
+
+        std::vector<uint32_t> codes;
+        std::vector<uint32_t> children;
+        src.children_.for_each([&](uint32_t child) {
+            if (child != Source::end_id) {
+                codes.push_back(code_of(source.nodes_[child].key_));
+                children.push_back(child);
+            }
+        });
+
+        if (codes.empty()) {
+            return;
+        }
+
+        int32_t base = find_base(codes);
+        extend(static_cast<size_t>(base) + codes.back() + 1);
+
+        base_[state] = base;
+        first_code_[state] = codes.front();
+        for (size_t i = 0; i < codes.size(); ++i) {
+            auto cell = base + static_cast<int32_t>(codes[i]);
+
+            unlink_free(cell);
+            check_[cell] = static_cast<int32_t>(state);
+            next_code_[cell] = i + 1 < codes.size() ? codes[i + 1] : 0;
+        }
+
+        for (size_t i = 0; i < children.size(); ++i) {
+            place(source, children[i],
+                  static_cast<state_type>(base + codes[i]));
+        }
+    }
+
+    template <class Function>
+    void visit(state_type state, key_string& key, Function& func) const {
+        for (auto child = first_child(state); child != npos;
+             child = next_sibling(child)) {
+            key.push_back(alphabet_[code_into(child) - 1]);
+            visit(child, key, func);
+            key.pop_back();
+        }
+
+        if (has_value(state)) {
+            func(static_cast<const key_string&>(key),
+                 values_[value_id_[state]]);
+        }
+    }
+
+public:
+    struct search_iterator {
+    private:
+        const frozen_trie* trie_;
+        state_type state_;
+
+    public:
+        search_iterator(const frozen_trie* owner, state_type state)
+          : trie_(owner)
+          , state_(state)
+        {}
+
+        const T& value() const {
+            return trie_->values_[trie_->value_id_[state_]];
+        }
+
+        key_string key() const {
+            key_string key_str;
+
+            for (auto state = state_; state != root;
+                 state = static_cast<state_type>(trie_->check_[state])) {
+                key_str.push_back(
+                    trie_->alphabet_[trie_->code_into(state) - 1]
+                );
+            }
+            std::reverse(key_str.begin(), key_str.end());
+
+            return key_str;
+        }
+
+        std::pair<std::basic_string<KeyType>, T> operator*() const {
+            return std::make_pair(key(), value());
+        }
+
+        // Same post-order as trie::search_iterator
+        search_iterator operator++() {
+            if (state_ == npos) {
+                throw std::out_of_range{
+                    "Iterator to end couldn't be incremented"
+                };
+            }
+
+            auto state = state_;
+            while (true) {
+                if (state == root) {
+                    state_ = npos;
+                    return *this;
+                }
+
+                auto next = trie_->next_sibling(state);
+                if (next != npos) {
+                    state_ = trie_->first_leaf(next);
+                    return *this;
+                }
+
+                state = static_cast<state_type>(trie_->check_[state]);
+                if (state != root && trie_->has_value(state)) {
+                    state_ = state;
+                    return *this;
+                }
+            }
+        }
+        const search_iterator operator++(int) {
+            search_iterator old_state(*this);
+            operator++();
+            return old_state;
+        }
+
+        bool operator==(const search_iterator& rhs) const {
+            return state_ == rhs.state_;
+        }
+        bool operator!=(const search_iterator& rhs) const {
+            return state_ != rhs.state_;
+        }
+    };
+
+    frozen_trie()
+      : byte_codes_(sizeof(KeyType) == 1 ? 256 : 0, 0)
+      , base_(1, 0)
+      , check_(1, 0)
+      , value_id_(1, npos)
+      , first_code_(1, 0)
+      , next_code_(1, 0)
+    {}
+
+    template <class Allocator>
+    explicit frozen_trie(const trie<T, KeyType, Allocator>& source)
+      : frozen_trie()
+    {
+        // Without keys the default-constructed state is already complete
+        if (source.empty()) {
+            return;
+        }
+
+        collect_alphabet(source, source.top_id, alphabet_);
+        std::sort(alphabet_.begin(), alphabet_.end());
+        alphabet_.erase(std::unique(alphabet_.begin(), alphabet_.end()),
+                        alphabet_.end());
+
+        if constexpr (sizeof(KeyType) == 1) {
+            for (size_t i = 0; i < alphabet_.size(); ++i) {
+                byte_codes_[static_cast<uint8_t>(alphabet_[i])] =
+                    static_cast<uint32_t>(i + 1);
+            }
+        }
+
+        values_.reserve(source.size());
+        place(source, source.top_id, root);
+
+        next_free_ = std::vector<int32_t>{};
+        prev_free_ = std::vector<int32_t>{};
+        free_head_ = free_cell;
+    }
+
+    search_iterator begin() const {
+        if (empty()) {
+            return end();
+        }
+
+        return search_iterator(this, first_leaf(root));
+    }
+
+    search_iterator end() const {
+        return search_iterator(this, npos);
+    }
+
+    size_t size() const { return values_.size(); }
+    bool empty() const { return values_.empty(); }
+
+    search_iterator find(const key_string& key) const {
+        auto state = descend(key);
+
+        if (state == npos || state == root || !has_value(state)) {
+            return end();
+        }
+
+        return search_iterator(this, state);
+    }
+
+    bool get_value(const key_string& key, T& container) const {
+        auto found_iter = find(key);
+
+        if (found_iter == end()) {
+            return false;
+        }
+
+        container = found_iter.value();
+
+        return true;
+    }
+
+    // Longest stored key that is a prefix of query
+    search_iterator longest_prefix_of(const key_string& query) const {
+        state_type state = root;
+        state_type longest = npos;
+
+        for (auto key_char : query) {
+            state = transition(state, key_char);
+            if (state == npos) {
+                break;
+            }
+            if (has_value(state)) {
+                longest = state;
+            }
+        }
+
+        return search_iterator(this, longest);
+    }
+
+    // Calls func(key, value) for every key starting with prefix, in the
+    // same order as iteration
+    template <class Function>
+    void for_each_with_prefix(const key_string& prefix, Function func) const {
+        auto state = descend(prefix);
+        if (state == npos) {
+            return;
+        }
+
+        key_string key = prefix;
+        visit(state, key, func);
+    }
+};
+
+#endif // INCLUDE_FROZEN_TRIE_HPP_
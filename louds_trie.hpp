@@ -0,0 +1,511 @@
+// Copyright 2019 AndreevSemen
+
+#ifndef INCLUDE_LOUDS_TRIE_HPP_
+#define INCLUDE_LOUDS_TRIE_HPP_
+
+#include <algorithm>
+#include <iterator>
+#include <string>
+#include <vector>
+#include <utility>
+#include <exception>
+#include <stdexcept>
+#include <limits>
+#include <cstdint>
+
+#include "trie.hpp"
+
+// Append-only bit vector with rank and select. Ranks are sampled every
+// 512 bits (one 32-bit counter per eight words); select bisects the
+// samples and finishes with popcounts inside the block.
+class rank_select_bits
+{
+private:
+    static constexpr size_t word_bits = 64;
+    static constexpr size_t block_words = 8;
+    static constexpr size_t block_bits = word_bits * block_words;
+
+    std::vector<uint64_t> words_;
+    std::vector<uint32_t> block_ranks_;
+    size_t size_ = 0;
+
+    static size_t select_in_word(uint64_t word, size_t nth) {
+        for (size_t i = 0; i < nth; ++i) {
+            word &= word - 1;
+        }
+
+        return static_cast<size_t>(__builtin_ctzll(word));
+    }
+
+    // Ones before block, or zeros when counting zeros
+    size_t block_count(size_t block, bool ones) const {
+        return ones ? block_ranks_[block]
+                    : block * block_bits - block_ranks_[block];
+    }
+
+    size_t select(size_t nth, bool ones) const {
+        size_t left = 0;
+        size_t right = block_ranks_.size();
+
+        // Last block that starts with at most nth matching bits before it
+        while (right - left > 1) {
+            size_t mid = left + (right - left) / 2;
+
+            if (block_count(mid, ones) <= nth) {
+                left = mid;
+            } else {
+                right = mid;
+            }
+        }
+
+        nth -= block_count(left, ones);
+        for (size_t word = left * block_words; word < words_.size(); ++word) {
+            uint64_t bits = ones ? words_[word] : ~words_[word];
+            auto count = static_cast<size_t>(__builtin_popcountll(bits));
+
+            if (nth < count) {
+                return word * word_bits + select_in_word(bits, nth);
+            }
+            nth -= count;
+        }
+
+        throw std::out_of_range{
+            "Select past the end of bit vector"
+        };
+    }
+
+public:
+    void push_back(bool bit) {
+        if (size_ % word_bits == 0) {
+            words_.push_back(0);
+        }
+        if (bit) {
+            words_.back() |= uint64_t{1} << (size_ % word_bits);
+        }
+
+        ++size_;
+    }
+
+    // Must be called once all bits are appended
+    void build_index() {
+        block_ranks_.clear();
+
+        uint32_t rank = 0;
+        for (size_t word = 0; word < words_.size(); ++word) {
+            if (word % block_words == 0) {
+                block_ranks_.push_back(rank);
+            }
+            rank += static_cast<uint32_t>(__builtin_popcountll(words_[word]));
+        }
+
+        // Closing sample so that rank1(size()) stays in range
+        block_ranks_.push_back(rank);
+    }
+
+    size_t size() const { return size_; }
+
+    bool operator[](size_t pos) const {
+        return (words_[pos / word_bits] >> (pos % word_bits)) & 1;
+    }
+
+    // Ones in [0, pos)
+    size_t rank1(size_t pos) const {
+        size_t block = pos / block_bits;
+        size_t rank = block_ranks_[block];
+
+        for (size_t word = block * block_words; word < pos / word_bits;
+             ++word) {
+            rank += static_cast<size_t>(__builtin_popcountll(words_[word]));
+        }
+        if (pos % word_bits != 0) {
+            uint64_t mask = (uint64_t{1} << (pos % word_bits)) - 1;
+            rank += static_cast<size_t>(
+                __builtin_popcountll(words_[pos / word_bits] & mask)
+            );
+        }
+
+        return rank;
+    }
+
+    size_t rank0(size_t pos) const {
+        return pos - rank1(pos);
+    }
+
+    // Position of the nth one, counting from zero
+    size_t select1(size_t nth) const {
+        return select(nth, true);
+    }
+
+    size_t select0(size_t nth) const {
+        return select(nth, false);
+    }
+
+    size_t memory_bytes() const {
+        return words_.size() * sizeof(uint64_t) +
+               block_ranks_.size() * sizeof(uint32_t);
+    }
+};
+
+// Read-only trie in level-order unary degree sequence form. Nodes are
+// numbered breadth-first (root is 0) and described by 1^degree 0 in
+// that order, behind a leading "10" for a virtual super root, so node x
+// is the x-th one and its children follow the x-th zero. Structure costs
+// about two bits per node; labels, a terminal bit per node and the
+// values are kept in breadth-first order beside it.
+template <class T, class KeyType = wchar_t>
+class louds_trie
+{
+private:
+    typedef std::basic_string<KeyType> key_string;
+    typedef size_t node_type;
+
+    static constexpr node_type npos = std::numeric_limits<node_type>::max();
+    static constexpr node_type root = 0;
+
+    rank_select_bits louds_;
+    rank_select_bits terminal_;
+    std::vector<KeyType> labels_;
+    std::vector<T> values_;
+
+    void add_node(const T* value) {
+        terminal_.push_back(value != nullptr);
+        if (value != nullptr) {
+            values_.push_back(*value);
+        }
+        louds_.push_back(false);
+    }
+
+    void add_child(KeyType label) {
+        louds_.push_back(true);
+        labels_.push_back(label);
+    }
+
+    void start_build() {
+        louds_.push_back(true);
+        louds_.push_back(false);
+        labels_.push_back(KeyType{});
+    }
+
+    void finish_build() {
+        louds_.build_index();
+        terminal_.build_index();
+    }
+
+    // Ids of node's children form [first, first + count)
+    std::pair<node_type, size_t> children(node_type node) const {
+        size_t start = louds_.select0(node) + 1;
+        size_t count = 0;
+
+        while (start + count < louds_.size() && louds_[start + count]) {
+            ++count;
+        }
+
+        return {louds_.rank1(start), count};
+    }
+
+    node_type first_child(node_type node) const {
+        size_t start = louds_.select0(node) + 1;
+
+        if (start >= louds_.size() || !louds_[start]) {
+            return npos;
+        }
+
+        return louds_.rank1(start);
+    }
+
+    node_type next_sibling(node_type node) const {
+        size_t pos = louds_.select1(node) + 1;
+
+        return pos < louds_.size() && louds_[pos] ? node + 1 : npos;
+    }
+
+    node_type parent(node_type node) const {
+        return louds_.rank0(louds_.select1(node)) - 1;
+    }
+
+    node_type child(node_type node, KeyType label) const {
+        auto range = children(node);
+        size_t pos = trie_detail::find_key(labels_.data() + range.first,
+                                           range.second, label);
+
+        return pos == range.second ? npos : range.first + pos;
+    }
+
+    bool has_value(node_type node) const {
+        return terminal_[node];
+    }
+
+    const T& value_of(node_type node) const {
+        return values_[terminal_.rank1(node)];
+    }
+
+    node_type descend(const key_string& key) const {
+        node_type node = root;
+
+        for (auto key_char : key) {
+            node = child(node, key_char);
+            if (node == npos) {
+                return npos;
+            }
+        }
+
+        return node;
+    }
+
+    node_type first_leaf(node_type node) const {
+        for (auto next = first_child(node); next != npos;
+             next = first_child(node)) {
+            node = next;
+        }
+
+        return node;
+    }
+
+    template <class Function>
+    void visit(node_type node, key_string& key, Function& func) const {
+        for (auto next = first_child(node); next != npos;
+             next = next_sibling(next)) {
+            key.push_back(labels_[next]);
+            visit(next, key, func);
+            key.pop_back();
+        }
+
+        if (has_value(node)) {
+            func(static_cast<const key_string&>(key), value_of(node));
+        }
+    }
+
+public:
+    struct search_iterator {
+    private:
+        const louds_trie* trie_;
+        node_type node_;
+
+    public:
+        search_iterator(const louds_trie* owner, node_type node)
+          : trie_(owner)
+          , node_(node)
+        {}
+
+        const T& value() const {
+            return trie_->value_of(node_);
+        }
+
+        key_string key() const {
+            key_string key_str;
+
+            for (auto node = node_; node != root; node = trie_->parent(node)) {
+                key_str.push_back(trie_->labels_[node]);
+            }
+            std::reverse(key_str.begin(), key_str.end());
+
+            return key_str;
+        }
+
+        std::pair<std::basic_string<KeyType>, T> operator*() const {
+            return std::make_pair(key(), value());
+        }
+
+        // Same post-order as trie::search_iterator
+        search_iterator operator++() {
+            if (node_ == npos) {
+                throw std::out_of_range{
+                    "Iterator to end couldn't be incremented"
+                };
+            }
+
+            auto node = node_;
+            while (true) {
+                if (node == root) {
+                    node_ = npos;
+                    return *this;
+                }
+
+                auto sibling = trie_->next_sibling(node);
+                if (sibling != npos) {
+                    node_ = trie_->first_leaf(sibling);
+                    return *this;
+                }
+
+                node = trie_->parent(node);
+                if (node != root && trie_->has_value(node)) {
+                    node_ = node;
+                    return *this;
+                }
+            }
+        }
+        const search_iterator operator++(int) {
+            search_iterator old_state(*this);
+            operator++();
+            return old_state;
+        }
+
+        bool operator==(const search_iterator& rhs) const {
+            return node_ == rhs.node_;
+        }
+        bool operator!=(const search_iterator& rhs) const {
+            return node_ != rhs.node_;
+        }
+    };
+
+    louds_trie() {
+        start_build();
+        add_node(nullptr);
+        finish_build();
+    }
+
+    template <class Allocator>
+    explicit louds_trie(const trie<T, KeyType, Allocator>& source) {
+        typedef trie<T, KeyType, Allocator> source_type;
+
+        std::vector<uint32_t> level{source_type::top_id};
+
+        values_.reserve(source.size());
+        start_build();
+
+        // Without keys only the root is encoded
+        if (source.empty()) {
+            add_node(nullptr);
+            finish_build();
+            return;
+        }
+
+        for (size_t head = 0; head < level.size(); ++head) {
+            auto node = level[head];
+
+            source.nodes_[node].children_.for_each([&](uint32_t next) {
+                if (next != source_type::end_id) {
+                    add_child(source.nodes_[next].key_);
+                    level.push_back(next);
+                }
+            });
+            add_node(source.value_of(node));
+        }
+
+        finish_build();
+    }
+
+    // Builds from unique key/value pairs sorted character by character
+    // as KeyType values, which is the order trie keeps children in
+    template <class InputIt>
+    louds_trie(InputIt first, InputIt last) {
+        std::vector<std::pair<key_string, T>> items(first, last);
+
+        // Equal neighbours would be read past the end of the shorter key
+        auto out_of_order = std::adjacent_find(
+            items.begin(), items.end(),
+            [](const auto& lhs, const auto& rhs) {
+                return !std::lexicographical_compare(
+                    lhs.first.begin(), lhs.first.end(),
+                    rhs.first.begin(), rhs.first.end()
+                );
+            });
+        if (out_of_order != items.end()) {
+            throw std::invalid_argument{
+                "Keys must be sorted and unique"
+            };
+        }
+
+        // Key range and depth of every node, in breadth-first order
+        struct span {
+            size_t first_;
+            size_t last_;
+            size_t depth_;
+        };
+        std::vector<span> level{{0, items.size(), 0}};
+
+        values_.reserve(items.size());
+        start_build();
+
+        for (size_t head = 0; head < level.size(); ++head) {
+            auto node = level[head];
+            size_t pos = node.first_;
+            const T* value = nullptr;
+
+            if (pos != node.last_ && items[pos].first.size() == node.depth_) {
+                if (node.depth_ == 0) {
+                    throw std::out_of_range{
+                        "Empty key couldn't be added"
+                    };
+                }
+                value = &items[pos].second;
+                ++pos;
+            }
+
+            while (pos != node.last_) {
+                KeyType label = items[pos].first[node.depth_];
+                size_t end = pos;
+
+                while (end != node.last_ &&
+                       items[end].first[node.depth_] == label) {
+                    ++end;
+                }
+
+                add_child(label);
+                level.push_back({pos, end, node.depth_ + 1});
+                pos = end;
+            }
+            add_node(value);
+        }
+
+        finish_build();
+    }
+
+    search_iterator begin() const {
+        if (empty()) {
+            return end();
+        }
+
+        return search_iterator(this, first_leaf(root));
+    }
+
+    search_iterator end() const {
+        return search_iterator(this, npos);
+    }
+
+    size_t size() const { return values_.size(); }
+    bool empty() const { return values_.empty(); }
+
+    search_iterator find(const key_string& key) const {
+        auto node = descend(key);
+
+        if (node == npos || node == root || !has_value(node)) {
+            return end();
+        }
+
+        return search_iterator(this, node);
+    }
+
+    bool get_value(const key_string& key, T& container) const {
+        auto found_iter = find(key);
+
+        if (found_iter == end()) {
+            return false;
+        }
+
+        container = found_iter.value();
+
+        return true;
+    }
+
+    // Calls func(key, value) for every key starting with prefix, in the
+    // same order as iteration
+    template <class Function>
+    void for_each_with_prefix(const key_string& prefix, Function func) const {
+        auto node = descend(prefix);
+        if (node == npos) {
+            return;
+        }
+
+        key_string key = prefix;
+        visit(node, key, func);
+    }
+
+    // Structure and label bytes, not counting the values
+    size_t memory_bytes() const {
+        return louds_.memory_bytes() + terminal_.memory_bytes() +
+               labels_.size() * sizeof(KeyType);
+    }
+};
+
+#endif // INCLUDE_LOUDS_TRIE_HPP_
@@ -0,0 +1,556 @@
+// Copyright 2019 AndreevSemen
+
+#ifndef INCLUDE_RADIX_TRIE_HPP_
+#define INCLUDE_RADIX_TRIE_HPP_
+
+#include <algorithm>
+#include <iterator>
+#include <string>
+#include <vector>
+#include <utility>
+#include <exception>
+#include <stdexcept>
+#include <limits>
+#include <memory>
+#include <memory_resource>
+
+// Path-compressed counterpart of trie: every chain of single-child,
+// valueless nodes is folded into one edge whose label holds the whole
+// substring. Iteration order matches trie. The API is the original one
+// of trie, before views and proxy iterators: keys are passed as strings,
+// insert returns a search_iterator and throws on an existing key, and
+// dereferencing copies the key and value.
+template <class T, class KeyType = wchar_t,
+          class Allocator = std::allocator<T>>
+class radix_trie
+{
+private:
+    typedef std::basic_string<KeyType> key_string;
+    typedef std::allocator_traits<Allocator> alloc_traits;
+
+    struct radix_node;
+    typedef typename alloc_traits::template rebind_alloc<radix_node*>
+        child_allocator;
+    typedef typename alloc_traits::template rebind_alloc<radix_node>
+        node_allocator;
+    typedef std::allocator_traits<node_allocator> node_traits;
+    typedef std::basic_string<
+        KeyType, std::char_traits<KeyType>,
+        typename alloc_traits::template rebind_alloc<KeyType>
+    > label_string;
+
+    struct radix_node {
+        label_string label_;
+        T value_{};
+        bool is_leaf_ = false;
+
+        radix_node* parent_ = nullptr;
+        std::vector<radix_node*, child_allocator> children_;
+
+        explicit radix_node(const Allocator& alloc)
+          : label_(alloc)
+          , children_(alloc)
+        {}
+
+        auto find_by_key(KeyType key_char) {
+            auto left = children_.begin();
+            auto right = children_.end();
+
+            while (left < right) {
+                auto mid = left + std::distance(left, right)/2;
+
+                if ((*mid)->label_.front() == key_char) {
+                    return mid;
+                }
+
+                if ((*mid)->label_.front() > key_char) {
+                    right = mid;
+                } else {
+                    left = mid + 1;
+                }
+            }
+
+            return children_.end();
+        }
+
+        void push_child(radix_node* child) {
+            auto pos = std::upper_bound(
+                children_.begin(), children_.end(), child,
+                [](const radix_node* lhs, const radix_node* rhs) {
+                    return lhs->label_.front() < rhs->label_.front();
+                }
+            );
+
+            children_.insert(pos, child);
+        }
+
+        void replace_child(radix_node* old_child, radix_node* new_child) {
+            *find_by_key(old_child->label_.front()) = new_child;
+        }
+    };
+
+    radix_node* create_node(radix_node* parent) {
+        auto node = node_traits::allocate(alloc_, 1);
+        node_traits::construct(alloc_, node, alloc_);
+        node->parent_ = parent;
+
+        return node;
+    }
+
+    void destroy_node(radix_node* node) {
+        node_traits::destroy(alloc_, node);
+        node_traits::deallocate(alloc_, node, 1);
+    }
+
+    void destroy_subtree(radix_node* node) {
+        for (auto& child : node->children_) {
+            destroy_subtree(child);
+        }
+
+        destroy_node(node);
+    }
+
+    radix_node* clone_subtree(const radix_node* src, radix_node* parent) {
+        auto node = create_node(parent);
+        node->label_ = src->label_;
+        node->value_ = src->value_;
+        node->is_leaf_ = src->is_leaf_;
+
+        node->children_.reserve(src->children_.size());
+        for (const auto& child : src->children_) {
+            node->children_.push_back(clone_subtree(child, node));
+        }
+
+        return node;
+    }
+
+    void create_end_prefix() {
+        auto end = create_node(top_);
+
+        end->label_.assign(1, std::numeric_limits<KeyType>::max());
+        end->is_leaf_ = true;
+
+        top_->children_.push_back(end);
+    }
+
+    // Folds a valueless node with a single child into that child
+    void merge_with_child(radix_node* node) {
+        auto child = node->children_.front();
+
+        child->label_.insert(0, node->label_);
+        child->parent_ = node->parent_;
+        node->parent_->replace_child(node, child);
+
+        node->children_.clear();
+        destroy_node(node);
+    }
+
+    node_allocator alloc_;
+    radix_node* top_;
+    size_t size_;
+
+public:
+    struct search_iterator {
+    private:
+        radix_node* node_;
+
+        static radix_node* last_leaf(radix_node* node) {
+            while (!node->is_leaf_) {
+                node = node->children_.back();
+            }
+
+            return node;
+        }
+
+    public:
+        explicit search_iterator(radix_node* ptr)
+          : node_(ptr)
+        {}
+
+        const T& value() const {
+            return node_->value_;
+        }
+        T& value() {
+            return node_->value_;
+        }
+
+        key_string key() const {
+            std::vector<const radix_node*> path;
+            size_t length = 0;
+
+            for (auto node = node_; node->parent_ != nullptr;
+                 node = node->parent_) {
+                path.push_back(node);
+                length += node->label_.size();
+            }
+
+            key_string key_str;
+            key_str.reserve(length);
+            for (auto r_iter = path.rbegin(); r_iter != path.rend(); ++r_iter) {
+                key_str.append((*r_iter)->label_.data(),
+                               (*r_iter)->label_.size());
+            }
+
+            return key_str;
+        }
+
+        void advance(const key_string& sub_key) {
+            if (sub_key.empty()) {
+                throw std::invalid_argument{
+                    "Advance with zero prefix"
+                };
+            }
+
+            auto sub_iter = sub_key.cbegin();
+            radix_node* node = node_;
+
+            while (sub_iter != sub_key.cend()) {
+                auto found = node->find_by_key(*sub_iter);
+                if (found == node->children_.cend() ||
+                    static_cast<size_t>(sub_key.cend() - sub_iter) <
+                        (*found)->label_.size() ||
+                    !std::equal((*found)->label_.cbegin(),
+                                (*found)->label_.cend(), sub_iter)) {
+                    throw std::runtime_error{
+                        "No such prefix"
+                    };
+                }
+                sub_iter += (*found)->label_.size();
+                node = *found;
+            }
+
+            node_ = node;
+        }
+
+        std::pair<std::basic_string<KeyType>, T> operator*() const {
+            return std::make_pair(key(), node_->value_);
+        }
+
+        // Arithmetical operators
+        search_iterator operator++() {
+            if (node_->parent_ != nullptr &&
+                node_->parent_->parent_ == nullptr &&
+                node_ == node_->parent_->children_.back()) {
+                throw std::out_of_range{
+                    "Iterator to end couldn't be incremented"
+                };
+            }
+
+            radix_node* node = node_;
+
+            // Shift right, or up to a parent holding a value
+            while (true) {
+                auto parent = node->parent_;
+                auto next_child = ++parent->find_by_key(node->label_.front());
+
+                if (next_child != parent->children_.end()) {
+                    node = *next_child;
+                    break;
+                }
+
+                node = parent;
+                if (node->is_leaf_) {
+                    node_ = node;
+                    return *this;
+                }
+            }
+
+            // Shift down
+            while (!node->children_.empty()) {
+                node = node->children_.front();
+            }
+
+            node_ = node;
+            return *this;
+        }
+        const search_iterator operator++(int) {
+            search_iterator old_state(*this);
+            operator++();
+            return old_state;
+        }
+
+        search_iterator operator--() {
+            radix_node* node = node_;
+
+            // Shift down
+            if (!node->children_.empty()) {
+                node_ = last_leaf(node->children_.back());
+                return *this;
+            }
+
+            // Shift left
+            while (true) {
+                auto parent = node->parent_;
+                if (parent == nullptr) {
+                    throw std::out_of_range{
+                        "Begin iterator couldn't be decremented"
+                    };
+                }
+
+                auto prev_child = parent->find_by_key(node->label_.front());
+                if (prev_child != parent->children_.begin()) {
+                    node_ = last_leaf(*(--prev_child));
+                    return *this;
+                }
+
+                node = parent;
+            }
+        }
+        const search_iterator operator--(int) {
+            auto old_state(*this);
+            operator--();
+            return old_state;
+        }
+
+        bool operator==(const search_iterator& rhs) const {
+            return node_ == rhs.node_;
+        }
+        bool operator!=(const search_iterator& rhs) const {
+            return node_ != rhs.node_;
+        }
+
+        friend radix_trie;
+    };
+
+    typedef Allocator allocator_type;
+
+    radix_trie()
+      : radix_trie(Allocator())
+    {}
+
+    explicit radix_trie(const Allocator& alloc)
+      : alloc_(alloc)
+      , size_(0)
+    {
+        top_ = create_node(nullptr);
+        create_end_prefix();
+    }
+
+    radix_trie(const radix_trie& oth)
+      : radix_trie(oth, alloc_traits::select_on_container_copy_construction(
+                            oth.get_allocator()))
+    {}
+
+    radix_trie(const radix_trie& oth, const Allocator& alloc)
+      : alloc_(alloc)
+      , size_(oth.size_)
+    {
+        top_ = clone_subtree(oth.top_, nullptr);
+    }
+
+    ~radix_trie() {
+        destroy_subtree(top_);
+    }
+
+    radix_trie& operator=(const radix_trie& rhs) {
+        if (this != &rhs) {
+            radix_trie copy{rhs, get_allocator()};
+            swap(copy);
+        }
+
+        return *this;
+    }
+
+    allocator_type get_allocator() const { return Allocator(alloc_); }
+
+    search_iterator begin() const {
+        if (empty()) {
+            return end();
+        }
+
+        radix_node* node = top_;
+
+        while (!node->children_.empty()) {
+            node = node->children_.front();
+        }
+
+        return search_iterator(node);
+    }
+
+    search_iterator end() const {
+        return search_iterator{top_->children_.back()};
+    }
+
+    size_t size() const { return size_; }
+    bool empty() const { return top_->children_.size() == 1; }
+
+    search_iterator insert(const std::pair<key_string, T>& data) {
+        if (data.first.empty()) {
+            throw std::out_of_range{
+                "Empty key couldn't be added"
+            };
+        }
+        // It would be stored on the end marker's edge, out of reach
+        if (data.first.front() == std::numeric_limits<KeyType>::max()) {
+            throw std::out_of_range{
+                "Key couldn't start with the end marker"
+            };
+        }
+
+        const auto& key = data.first;
+        size_t pos = 0;
+        radix_node* node = top_;
+
+        while (pos != key.size()) {
+            auto found = node->find_by_key(key[pos]);
+
+            if (found == node->children_.end()) {
+                auto leaf = create_node(node);
+                leaf->label_.assign(key, pos, key_string::npos);
+                leaf->value_ = data.second;
+                leaf->is_leaf_ = true;
+                node->push_child(leaf);
+
+                ++size_;
+
+                return search_iterator{leaf};
+            }
+
+            auto child = *found;
+            auto mismatch = std::mismatch(
+                child->label_.cbegin(), child->label_.cend(),
+                key.cbegin() + pos, key.cend()
+            );
+            size_t common = mismatch.first - child->label_.cbegin();
+
+            if (common != child->label_.size()) {
+                // Split the edge at the first mismatching character
+                auto middle = create_node(node);
+                middle->label_.assign(child->label_, 0, common);
+                *found = middle;
+
+                child->label_.erase(0, common);
+                child->parent_ = middle;
+                middle->children_.push_back(child);
+            }
+
+            pos += common;
+            node = *found;
+        }
+
+        if (node->is_leaf_) {
+            throw std::out_of_range{
+                "Key already exists"
+            };
+        }
+
+        node->value_ = data.second;
+        node->is_leaf_ = true;
+
+        ++size_;
+
+        return search_iterator{node};
+    }
+
+    void erase(search_iterator iter) {
+        radix_node* node = iter.node_;
+        node->is_leaf_ = false;
+
+        --size_;
+
+        if (node->children_.size() > 1) {
+            return;
+        }
+
+        if (node->children_.size() == 1) {
+            merge_with_child(node);
+            return;
+        }
+
+        auto parent = node->parent_;
+        auto found = parent->find_by_key(node->label_.front());
+        parent->children_.erase(found);
+        destroy_node(node);
+
+        if (parent != top_ && !parent->is_leaf_ &&
+            parent->children_.size() == 1) {
+            merge_with_child(parent);
+        }
+    }
+
+    void swap(radix_trie& oth) {
+        using std::swap;
+
+        if constexpr (alloc_traits::propagate_on_container_swap::value) {
+            swap(alloc_, oth.alloc_);
+        }
+        swap(top_, oth.top_);
+        swap(size_, oth.size_);
+    }
+
+    void clear() {
+        destroy_subtree(top_);
+
+        top_ = create_node(nullptr);
+        create_end_prefix();
+
+        size_ = 0;
+    }
+
+    search_iterator find(const key_string& key) const {
+        size_t pos = 0;
+        radix_node* node = top_;
+
+        while (pos != key.size()) {
+            auto found = node->find_by_key(key[pos]);
+
+            if (found == node->children_.end() ||
+                key.compare(pos, (*found)->label_.size(),
+                            (*found)->label_.data(),
+                            (*found)->label_.size()) != 0) {
+                return end();
+            }
+
+            pos += (*found)->label_.size();
+            node = *found;
+        }
+
+        if (node == top_ || !node->is_leaf_) {
+            return end();
+        }
+
+        return search_iterator(node);
+    }
+
+    bool get_value(const key_string& prefix, T& container) const {
+        auto found_iter = find(prefix);
+
+        if (found_iter == end()) {
+            return false;
+        }
+
+        container = found_iter.value();
+
+        return true;
+    }
+
+    search_iterator find_longest_prefix() const {
+        size_t max_length = 0;
+        auto long_iter = end();
+
+        for (auto iter = begin(); iter != end(); ++iter) {
+            size_t length = iter.key().size();
+
+            if (length > max_length) {
+                max_length = length;
+                long_iter = iter;
+            }
+        }
+
+        return long_iter;
+    }
+};
+
+template < typename T, typename KeyType, typename Allocator >
+void swap(radix_trie<T, KeyType, Allocator>& lhs,
+          radix_trie<T, KeyType, Allocator>& rhs) {
+    lhs.swap(rhs);
+}
+
+namespace pmr {
+template < typename T, typename KeyType = wchar_t >
+using radix_trie =
+    ::radix_trie<T, KeyType, std::pmr::polymorphic_allocator<T>>;
+}  // namespace pmr
+
+#endif // INCLUDE_RADIX_TRIE_HPP_
@@ -8,488 +8,2809 @@
 #include <algorithm>
 #include <iterator>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <utility>
 #include <exception>
 #include <limits>
+#include <cstddef>
+#include <new>
+#include <memory>
+#include <memory_resource>
+#include <cstdint>
+#include <type_traits>
+#include <thread>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define TRIE_HAS_AVX2_DISPATCH 1
+#endif
+
+// Defining TRIE_NO_PARENT_LINKS before including this header drops the
+// parent link from every node. Iterators then keep the whole path from
+// the root instead of climbing, which they rebuild from parent links
+// otherwise.
+
+namespace trie_detail {
+
+// Position of key in a sorted array of count keys, or count if absent.
+// The vector kernels compare a whole register of keys per step and stop
+// at the first block that ends past key.
+template <class Key>
+size_t find_key_scalar(const Key* keys, size_t count, Key key) {
+    for (size_t i = 0; i < count && !(key < keys[i]); ++i) {
+        if (keys[i] == key) {
+            return i;
+        }
+    }
+
+    return count;
+}
+
+#if defined(__SSE2__)
+template <class Key>
+__m128i cmpeq_sse2(__m128i lhs, __m128i rhs) {
+    if constexpr (sizeof(Key) == 1) {
+        return _mm_cmpeq_epi8(lhs, rhs);
+    } else if constexpr (sizeof(Key) == 2) {
+        return _mm_cmpeq_epi16(lhs, rhs);
+    } else {
+        return _mm_cmpeq_epi32(lhs, rhs);
+    }
+}
+
+template <class Key>
+__m128i set1_sse2(Key key) {
+    if constexpr (sizeof(Key) == 1) {
+        return _mm_set1_epi8(static_cast<char>(key));
+    } else if constexpr (sizeof(Key) == 2) {
+        return _mm_set1_epi16(static_cast<int16_t>(key));
+    } else {
+        return _mm_set1_epi32(static_cast<int32_t>(key));
+    }
+}
+
+template <class Key>
+size_t find_key_sse2(const Key* keys, size_t count, Key key) {
+    constexpr size_t lanes = sizeof(__m128i) / sizeof(Key);
+    const __m128i needle = set1_sse2(key);
+
+    size_t i = 0;
+    for (; i + lanes <= count; i += lanes) {
+        auto block = _mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(keys + i)
+        );
+        auto mask = static_cast<unsigned>(
+            _mm_movemask_epi8(cmpeq_sse2<Key>(block, needle))
+        );
+
+        if (mask != 0) {
+            return i + __builtin_ctz(mask) / sizeof(Key);
+        }
+        if (key < keys[i + lanes - 1]) {
+            return count;
+        }
+    }
+
+    return i + find_key_scalar(keys + i, count - i, key);
+}
+#endif
+
+#if defined(TRIE_HAS_AVX2_DISPATCH)
+template <class Key>
+__attribute__((target("avx2")))
+size_t find_key_avx2(const Key* keys, size_t count, Key key) {
+    constexpr size_t lanes = sizeof(__m256i) / sizeof(Key);
+    __m256i needle;
+    if constexpr (sizeof(Key) == 1) {
+        needle = _mm256_set1_epi8(static_cast<char>(key));
+    } else if constexpr (sizeof(Key) == 2) {
+        needle = _mm256_set1_epi16(static_cast<int16_t>(key));
+    } else {
+        needle = _mm256_set1_epi32(static_cast<int32_t>(key));
+    }
+
+    size_t i = 0;
+    for (; i + lanes <= count; i += lanes) {
+        auto block = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i*>(keys + i)
+        );
+        __m256i matches;
+        if constexpr (sizeof(Key) == 1) {
+            matches = _mm256_cmpeq_epi8(block, needle);
+        } else if constexpr (sizeof(Key) == 2) {
+            matches = _mm256_cmpeq_epi16(block, needle);
+        } else {
+            matches = _mm256_cmpeq_epi32(block, needle);
+        }
+        auto mask = static_cast<unsigned>(_mm256_movemask_epi8(matches));
+
+        if (mask != 0) {
+            return i + __builtin_ctz(mask) / sizeof(Key);
+        }
+        if (key < keys[i + lanes - 1]) {
+            return count;
+        }
+    }
 
-template <class T, class KeyType = wchar_t>
+    return i + find_key_scalar(keys + i, count - i, key);
+}
+#endif
+
+template <class Key>
+using find_key_function = size_t (*)(const Key*, size_t, Key);
+
+template <class Key>
+find_key_function<Key> select_find_key() {
+    if constexpr (sizeof(Key) == 1 || sizeof(Key) == 2 || sizeof(Key) == 4) {
+#if defined(TRIE_HAS_AVX2_DISPATCH)
+        if (__builtin_cpu_supports("avx2")) {
+            return &find_key_avx2<Key>;
+        }
+#endif
+#if defined(__SSE2__)
+        return &find_key_sse2<Key>;
+#endif
+    }
+
+    return &find_key_scalar<Key>;
+}
+
+// Wide fan-outs are first narrowed by bisection so the vector scan only
+// covers a few registers worth of keys
+template <class Key>
+size_t find_key(const Key* keys, size_t count, Key key) {
+    static const find_key_function<Key> kernel = select_find_key<Key>();
+    constexpr size_t scan_window = 64;
+
+    size_t base = 0;
+    size_t length = count;
+    while (length > scan_window) {
+        size_t half = length / 2;
+
+        if (keys[base + half] < key) {
+            base += half + 1;
+            length -= half + 1;
+        } else {
+            length = half + 1;
+        }
+    }
+
+    size_t found = kernel(keys + base, length, key);
+
+    return found == length ? count : base + found;
+}
+
+// What trie iterators dereference to: a view of the key, valid until the
+// iterator moves, and a reference to the stored value. Converts to the
+// iterators' value_type, a pair holding copies of both.
+template <class KeyType, class Value>
+struct entry {
+    std::basic_string_view<KeyType> first;
+    Value& second;
+
+    operator std::pair<std::basic_string<KeyType>,
+                       typename std::remove_const<Value>::type>() const {
+        return {std::basic_string<KeyType>(first), second};
+    }
+};
+
+}  // namespace trie_detail
+
+template <class T, class KeyType = wchar_t,
+          class Allocator = std::allocator<T>>
 class trie
 {
 private:
     typedef std::basic_string<KeyType> key_string;
+    // Lookups and insertions take keys as views, so strings, literals,
+    // {pointer, length} pairs and views into other buffers are all
+    // accepted without a temporary string
+    typedef std::basic_string_view<KeyType> key_view;
+    typedef std::allocator_traits<Allocator> alloc_traits;
+
+    // Nodes are addressed by their position in nodes_. Links take four
+    // bytes, and the node array can be moved or copied as one block
+    // without patching any pointers.
+    typedef uint32_t node_id;
+
+    static constexpr node_id no_node = std::numeric_limits<node_id>::max();
+    static constexpr node_id top_id = 0;
+    static constexpr node_id end_id = 1;
+
+    typedef typename alloc_traits::template rebind_alloc<node_id>
+        child_allocator;
+
+    // Child blocks are carved out of slabs owned by the trie and reused
+    // through one free list per block length, so new nodes rarely reach
+    // the allocator, and clear and the destructor hand back whole slabs
+    // instead of a block per node. Lengths are counted in uint64_t.
+    class block_pool : private alloc_traits::template rebind_alloc<uint64_t>
+    {
+    private:
+        typedef typename alloc_traits::template rebind_alloc<uint64_t>
+            block_allocator;
+        typedef std::allocator_traits<block_allocator> block_traits;
+
+        static constexpr size_t slab_length = 4096;
+
+        struct slab {
+            uint64_t* data_;
+            size_t length_;
+        };
+
+        std::vector<slab, typename alloc_traits::template rebind_alloc<slab>>
+            slabs_;
+        // Heads of the free lists by length, chained through the blocks
+        std::vector<uint64_t*,
+                    typename alloc_traits::template rebind_alloc<uint64_t*>>
+            free_;
+        uint64_t* cursor_ = nullptr;
+        size_t left_ = 0;
+
+        // The list grows before the slab is allocated, so recording the
+        // slab can't fail and leak it
+        uint64_t* add_slab(size_t length) {
+            if (slabs_.size() == slabs_.capacity()) {
+                slabs_.reserve(std::max<size_t>(2 * slabs_.capacity(), 8));
+            }
+
+            auto data = block_traits::allocate(*this, length);
+            slabs_.push_back({data, length});
+
+            return data;
+        }
+
+    public:
+        explicit block_pool(const Allocator& alloc)
+          : block_allocator(alloc)
+          , slabs_(alloc)
+          , free_(alloc)
+        {}
+        block_pool(block_pool&& oth) noexcept
+          : block_allocator(static_cast<block_allocator&&>(oth))
+          , slabs_(std::move(oth.slabs_))
+          , free_(std::move(oth.free_))
+          , cursor_(oth.cursor_)
+          , left_(oth.left_)
+        {
+            oth.slabs_.clear();
+            oth.free_.clear();
+            oth.cursor_ = nullptr;
+            oth.left_ = 0;
+        }
+
+        // Only used when the allocator propagates on move assignment
+        block_pool& operator=(block_pool&& oth) noexcept {
+            release();
+            static_cast<block_allocator&>(*this) =
+                static_cast<block_allocator&&>(oth);
+            slabs_ = std::move(oth.slabs_);
+            free_ = std::move(oth.free_);
+            cursor_ = oth.cursor_;
+            left_ = oth.left_;
+
+            oth.slabs_.clear();
+            oth.free_.clear();
+            oth.cursor_ = nullptr;
+            oth.left_ = 0;
+
+            return *this;
+        }
+
+        ~block_pool() {
+            release();
+        }
+
+        // Blocks longer than a quarter slab get a slab of their own
+        uint64_t* allocate(size_t length) {
+            if (length < free_.size() && free_[length] != nullptr) {
+                auto block = free_[length];
+                free_[length] = *reinterpret_cast<uint64_t**>(block);
+
+                return block;
+            }
+
+            // Sized here so that deallocate never has to grow it
+            if (free_.size() <= length) {
+                free_.resize(length + 1, nullptr);
+            }
+
+            if (length > slab_length / 4) {
+                return add_slab(length);
+            }
+            if (length > left_) {
+                cursor_ = add_slab(slab_length);
+                left_ = slab_length;
+            }
+
+            auto block = cursor_;
+            cursor_ += length;
+            left_ -= length;
+
+            return block;
+        }
+
+        void deallocate(uint64_t* block, size_t length) noexcept {
+            *reinterpret_cast<uint64_t**>(block) = free_[length];
+            free_[length] = block;
+        }
+
+        // Drops every block at once
+        void release() noexcept {
+            for (const auto& each : slabs_) {
+                block_traits::deallocate(*this, each.data_, each.length_);
+            }
+
+            slabs_.clear();
+            std::fill(free_.begin(), free_.end(), nullptr);
+            cursor_ = nullptr;
+            left_ = 0;
+        }
+
+        // Takes over the slabs of oth, whose allocator must compare
+        // equal, so that blocks from it can be kept and freed here
+        void adopt(block_pool& oth) {
+            if (free_.size() < oth.free_.size()) {
+                free_.resize(oth.free_.size(), nullptr);
+            }
+
+            slabs_.insert(slabs_.end(), oth.slabs_.begin(), oth.slabs_.end());
+            oth.slabs_.clear();
+            std::fill(oth.free_.begin(), oth.free_.end(), nullptr);
+            oth.cursor_ = nullptr;
+            oth.left_ = 0;
+        }
+
+        void swap(block_pool& oth) noexcept {
+            if constexpr (alloc_traits::propagate_on_container_swap::value) {
+                using std::swap;
+                swap(static_cast<block_allocator&>(*this),
+                     static_cast<block_allocator&>(oth));
+            }
+
+            slabs_.swap(oth.slabs_);
+            free_.swap(oth.free_);
+            std::swap(cursor_, oth.cursor_);
+            std::swap(left_, oth.left_);
+        }
+    };
+
+    // Values are constructed in fixed-size chunks that never move, so a
+    // reference to a value stays valid until its key is erased. Freed
+    // slots are chained through their storage and reused first. owners_
+    // holds the node of every slot in use and no_node for free ones.
+    class value_store : private Allocator {
+    private:
+        union slot {
+            node_id next_;
+            alignas(T) unsigned char storage_[sizeof(T)];
+        };
+
+        typedef Allocator base_type;
+        typedef typename alloc_traits::template rebind_alloc<slot>
+            slot_allocator;
+        typedef std::allocator_traits<slot_allocator> slot_traits;
+
+        static constexpr size_t chunk_size =
+            std::max<size_t>(16, 4096 / sizeof(slot));
+
+        std::vector<slot*, typename alloc_traits::template rebind_alloc<slot*>>
+            chunks_;
+        std::vector<node_id, child_allocator> owners_;
+        node_id free_ = no_node;
+        size_t size_ = 0;
+
+        slot& at(node_id id) const {
+            return chunks_[id / chunk_size][id % chunk_size];
+        }
+
+        static T* get(slot& place) {
+            return std::launder(reinterpret_cast<T*>(place.storage_));
+        }
+
+        // Makes room for slot ids below count
+        void add_chunks(size_t count) {
+            while (chunks_.size() * chunk_size < count) {
+                slot_allocator alloc(*this);
+                auto chunk = slot_traits::allocate(alloc, chunk_size);
+
+                try {
+                    chunks_.push_back(chunk);
+                } catch (...) {
+                    slot_traits::deallocate(alloc, chunk, chunk_size);
+                    throw;
+                }
+            }
+        }
+
+        void reset() noexcept {
+            chunks_.clear();
+            owners_.clear();
+            free_ = no_node;
+            size_ = 0;
+        }
+
+    public:
+        explicit value_store(const Allocator& alloc)
+          : base_type(alloc)
+          , chunks_(alloc)
+          , owners_(child_allocator(alloc))
+        {}
+
+        // Slots keep their ids, free ones included
+        value_store(const value_store& oth, const Allocator& alloc)
+          : value_store(alloc)
+        {
+            try {
+                add_chunks(oth.owners_.size());
+                owners_.reserve(oth.owners_.size());
+
+                for (node_id id = 0; id < oth.owners_.size(); ++id) {
+                    if (oth.owners_[id] == no_node) {
+                        at(id).next_ = oth.at(id).next_;
+                    } else {
+                        construct(id, *get(oth.at(id)));
+                        ++size_;
+                    }
+                    owners_.push_back(oth.owners_[id]);
+                }
+            } catch (...) {
+                release();
+                throw;
+            }
+
+            free_ = oth.free_;
+        }
+
+        value_store(value_store&& oth) noexcept
+          : base_type(static_cast<base_type&&>(oth))
+          , chunks_(std::move(oth.chunks_))
+          , owners_(std::move(oth.owners_))
+          , free_(oth.free_)
+          , size_(oth.size_)
+        {
+            oth.reset();
+        }
+
+        // Only used when the allocator propagates on move assignment
+        value_store& operator=(value_store&& oth) noexcept {
+            release();
+            static_cast<base_type&>(*this) = static_cast<base_type&&>(oth);
+            chunks_ = std::move(oth.chunks_);
+            owners_ = std::move(oth.owners_);
+            free_ = oth.free_;
+            size_ = oth.size_;
+            oth.reset();
+
+            return *this;
+        }
+
+        ~value_store() {
+            release();
+        }
+
+        size_t size() const { return size_; }
+        bool empty() const { return size_ == 0; }
+
+        T& operator[](node_id id) { return *get(at(id)); }
+        const T& operator[](node_id id) const { return *get(at(id)); }
+
+        template <class... Args>
+        void construct(node_id id, Args&&... args) {
+            Allocator alloc(*this);
+            alloc_traits::construct(alloc, get(at(id)),
+                                    std::forward<Args>(args)...);
+        }
+
+        // Constructs a value for owner and returns its slot id
+        template <class... Args>
+        node_id emplace(node_id owner, Args&&... args) {
+            node_id id = free_;
+            bool reused = id != no_node;
+            node_id next = no_node;
+
+            if (reused) {
+                next = at(id).next_;
+            } else {
+                id = static_cast<node_id>(owners_.size());
+                add_chunks(size_t{id} + 1);
+                owners_.push_back(no_node);
+            }
+
+            try {
+                construct(id, std::forward<Args>(args)...);
+            } catch (...) {
+                // A failed constructor may have overwritten the link
+                if (reused) {
+                    at(id).next_ = next;
+                } else {
+                    owners_.pop_back();
+                }
+                throw;
+            }
+
+            if (reused) {
+                free_ = next;
+            }
+            owners_[id] = owner;
+            ++size_;
+
+            return id;
+        }
+
+        void erase(node_id id) noexcept {
+            Allocator alloc(*this);
+            alloc_traits::destroy(alloc, get(at(id)));
+
+            at(id).next_ = free_;
+            free_ = id;
+            owners_[id] = no_node;
+            --size_;
+        }
+
+        void set_owner(node_id id, node_id owner) {
+            owners_[id] = owner;
+        }
+
+        // Destroys every value and hands back the chunks
+        void release() noexcept {
+            Allocator alloc(*this);
+            for (node_id id = 0; id < owners_.size(); ++id) {
+                if (owners_[id] != no_node) {
+                    alloc_traits::destroy(alloc, get(at(id)));
+                }
+            }
+
+            slot_allocator chunk_alloc(*this);
+            for (auto chunk : chunks_) {
+                slot_traits::deallocate(chunk_alloc, chunk, chunk_size);
+            }
+
+            reset();
+        }
+
+        // Takes over the chunks of oth, whose allocator must compare
+        // equal. Its slot ids go up by the returned delta and its owners
+        // by owner_delta; the rest of the last chunk here is left free.
+        node_id adopt(value_store& oth, node_id owner_delta) {
+            auto delta = static_cast<node_id>(chunks_.size() * chunk_size);
+
+            chunks_.reserve(chunks_.size() + oth.chunks_.size());
+            owners_.reserve(size_t{delta} + oth.owners_.size());
+
+            for (auto id = static_cast<node_id>(owners_.size()); id < delta;
+                 ++id) {
+                at(id).next_ = free_;
+                free_ = id;
+                owners_.push_back(no_node);
+            }
+
+            chunks_.insert(chunks_.end(), oth.chunks_.begin(),
+                           oth.chunks_.end());
+            for (node_id id = 0; id < oth.owners_.size(); ++id) {
+                if (oth.owners_[id] == no_node) {
+                    at(id + delta).next_ = free_;
+                    free_ = id + delta;
+                    owners_.push_back(no_node);
+                } else {
+                    owners_.push_back(oth.owners_[id] + owner_delta);
+                }
+            }
+
+            size_ += oth.size_;
+            oth.reset();
+
+            return delta;
+        }
+
+        void swap(value_store& oth) noexcept {
+            if constexpr (alloc_traits::propagate_on_container_swap::value) {
+                using std::swap;
+                swap(static_cast<base_type&>(*this),
+                     static_cast<base_type&>(oth));
+            }
+
+            chunks_.swap(oth.chunks_);
+            owners_.swap(oth.owners_);
+            std::swap(free_, oth.free_);
+            std::swap(size_, oth.size_);
+        }
+    };
+
+    // Children kept sorted by key character. Ids and characters share one
+    // block, ids first and characters right after them, so lookups scan
+    // the character array with trie_detail::find_key and never touch the
+    // child nodes themselves. Blocks come from the trie's block_pool,
+    // which every call that allocates takes, leaving a pointer and two
+    // 32-bit counters per node.
+    class sorted_children {
+    private:
+        node_id* ids_ = nullptr;
+        uint32_t size_ = 0;
+        uint32_t capacity_ = 0;
+
+        KeyType* keys() const {
+            return reinterpret_cast<KeyType*>(ids_ + capacity_);
+        }
+
+        // Capacities are multiples of four, which keeps the characters
+        // aligned for any KeyType up to eight bytes
+        static size_t block_length(size_t capacity) {
+            return (capacity * (sizeof(node_id) + sizeof(KeyType)) +
+                    sizeof(uint64_t) - 1) / sizeof(uint64_t);
+        }
+
+        void reallocate(block_pool& pool, size_t capacity) {
+            capacity = (capacity + 3) & ~size_t{3};
+
+            auto block = reinterpret_cast<node_id*>(
+                pool.allocate(block_length(capacity))
+            );
+            auto block_keys = reinterpret_cast<KeyType*>(block + capacity);
+
+            std::copy(ids_, ids_ + size_, block);
+            std::copy(keys(), keys() + size_, block_keys);
+
+            release(pool);
+            ids_ = block;
+            capacity_ = static_cast<uint32_t>(capacity);
+        }
+
+        void release(block_pool& pool) {
+            if (ids_ != nullptr) {
+                pool.deallocate(reinterpret_cast<uint64_t*>(ids_),
+                                block_length(capacity_));
+            }
+        }
+
+        size_t lower_bound(KeyType key_char) const {
+            return std::lower_bound(keys(), keys() + size_, key_char) -
+                   keys();
+        }
+
+        void insert_at(block_pool& pool, size_t pos, KeyType key_char,
+                       node_id child) {
+            if (size_ == capacity_) {
+                reallocate(pool, std::max<size_t>(2 * size_t{capacity_}, 4));
+            }
+
+            std::copy_backward(ids_ + pos, ids_ + size_, ids_ + size_ + 1);
+            std::copy_backward(keys() + pos, keys() + size_,
+                               keys() + size_ + 1);
+
+            ids_[pos] = child;
+            keys()[pos] = key_char;
+            ++size_;
+        }
+
+    public:
+        sorted_children() = default;
+        sorted_children(sorted_children&& oth) noexcept
+          : ids_(oth.ids_)
+          , size_(oth.size_)
+          , capacity_(oth.capacity_)
+        {
+            oth.ids_ = nullptr;
+            oth.size_ = 0;
+            oth.capacity_ = 0;
+        }
+        sorted_children& operator=(const sorted_children&) = delete;
+
+        void assign(block_pool& pool, const sorted_children& oth) {
+            clear(pool);
+            reserve(pool, oth.size_);
+
+            std::copy(oth.ids_, oth.ids_ + oth.size_, ids_);
+            std::copy(oth.keys(), oth.keys() + oth.size_, keys());
+            size_ = oth.size_;
+        }
+
+        void clear(block_pool& pool) {
+            release(pool);
+            ids_ = nullptr;
+            size_ = 0;
+            capacity_ = 0;
+        }
+
+        size_t size() const { return size_; }
+        bool empty() const { return size_ == 0; }
+
+        node_id front() const { return ids_[0]; }
+        node_id back() const { return ids_[size_ - 1]; }
+
+        node_id find(KeyType key_char) const {
+            size_t pos = trie_detail::find_key(keys(), size_, key_char);
+
+            return pos == size_ ? no_node : ids_[pos];
+        }
+
+        // Positions are indices into the sorted arrays. Iterators keep
+        // them to step between siblings without searching again.
+        uint32_t position(KeyType key_char) const {
+            size_t pos = trie_detail::find_key(keys(), size_, key_char);
+
+            return pos == size_ ? no_node : static_cast<uint32_t>(pos);
+        }
+
+        node_id at(uint32_t pos) const {
+            return pos < size_ ? ids_[pos] : no_node;
+        }
+
+        uint32_t first_position() const { return 0; }
+        uint32_t last_position() const { return size_ - 1; }
+
+        uint32_t next_position(uint32_t pos) const {
+            return pos + 1 < size_ ? pos + 1 : no_node;
+        }
+
+        uint32_t prev_position(uint32_t pos) const {
+            return pos == 0 ? no_node : pos - 1;
+        }
+
+        void insert(block_pool& pool, KeyType key_char, node_id child) {
+            insert_at(pool, lower_bound(key_char), key_char, child);
+        }
+
+        // Child key must be greater than every key already stored
+        void append(block_pool& pool, KeyType key_char, node_id child) {
+            insert_at(pool, size_, key_char, child);
+        }
+
+        void remove(block_pool&, KeyType key_char) {
+            size_t pos = lower_bound(key_char);
+
+            std::copy(ids_ + pos + 1, ids_ + size_, ids_ + pos);
+            std::copy(keys() + pos + 1, keys() + size_, keys() + pos);
+            --size_;
+        }
+
+        // Adds delta to every stored id
+        void shift_ids(node_id delta) {
+            std::for_each(ids_, ids_ + size_, [delta](node_id& id) {
+                id += delta;
+            });
+        }
+
+        void reserve(block_pool& pool, size_t count) {
+            if (count > capacity_) {
+                reallocate(pool, count);
+            }
+        }
+
+        template <class Function>
+        void for_each(Function func) const {
+            std::for_each(ids_, ids_ + size_, func);
+        }
+    };
+
+    // Adaptive radix tree layouts for byte keys: a node's children live in
+    // the smallest of Node4/Node16/Node48/Node256 that fits them and move
+    // between layouts as they grow and shrink. Leaves own no block at all.
+    class adaptive_children {
+    private:
+        enum block_kind : uint8_t { none, node4, node16, node48, node256 };
+
+        struct block4 {
+            uint8_t keys_[4];
+            node_id children_[4];
+        };
+        struct block16 {
+            uint8_t keys_[16];
+            node_id children_[16];
+        };
+        struct block48 {
+            // Zero marks an absent key, otherwise slot index plus one
+            uint8_t index_[256];
+            node_id children_[48];
+        };
+        struct block256 {
+            node_id children_[256];
+        };
+
+        static constexpr uint8_t sign_flip =
+            std::is_signed<KeyType>::value ? 0x80 : 0;
+
+        void* block_ = nullptr;
+        uint16_t count_ = 0;
+        block_kind kind_ = none;
+
+        // Maps a key onto 0..255 keeping the order of KeyType values
+        static uint8_t byte_of(KeyType key_char) {
+            return static_cast<uint8_t>(key_char) ^ sign_flip;
+        }
+
+        static int search16(const uint8_t* keys, unsigned count,
+                            uint8_t byte) {
+#if defined(__SSE2__)
+            auto matches = _mm_cmpeq_epi8(
+                _mm_set1_epi8(static_cast<char>(byte)),
+                _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys))
+            );
+            unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(matches)) &
+                            ((1u << count) - 1);
+
+            return mask == 0 ? -1 : __builtin_ctz(mask);
+#else
+            for (unsigned i = 0; i < count; ++i) {
+                if (keys[i] == byte) {
+                    return static_cast<int>(i);
+                }
+            }
+
+            return -1;
+#endif
+        }
+
+        template <class Block>
+        static constexpr size_t length_of() {
+            return (sizeof(Block) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+        }
+
+        template <class Block>
+        static Block* allocate(block_pool& pool) {
+            auto block = pool.allocate(length_of<Block>());
+
+            return ::new (static_cast<void*>(block)) Block{};
+        }
 
+        template <class Block>
+        static void deallocate(block_pool& pool, void* block) {
+            pool.deallocate(static_cast<uint64_t*>(block), length_of<Block>());
+        }
+
+        void release_block(block_pool& pool) {
+            switch (kind_) {
+            case node4: deallocate<block4>(pool, block_); break;
+            case node16: deallocate<block16>(pool, block_); break;
+            case node48: deallocate<block48>(pool, block_); break;
+            case node256: deallocate<block256>(pool, block_); break;
+            case none: break;
+            }
+        }
+
+        void replace_block(block_pool& pool, void* block, block_kind kind) {
+            release_block(pool);
+            block_ = block;
+            kind_ = kind;
+        }
+
+        size_t capacity() const {
+            switch (kind_) {
+            case node4: return 4;
+            case node16: return 16;
+            case node48: return 48;
+            case node256: return 256;
+            case none: break;
+            }
+
+            return 0;
+        }
+
+        template <class Block>
+        static void sorted_insert(Block* block, unsigned count, uint8_t byte,
+                                  node_id child) {
+            unsigned pos = count;
+
+            while (pos > 0 && block->keys_[pos - 1] > byte) {
+                block->keys_[pos] = block->keys_[pos - 1];
+                block->children_[pos] = block->children_[pos - 1];
+                --pos;
+            }
+
+            block->keys_[pos] = byte;
+            block->children_[pos] = child;
+        }
+
+        template <class Block>
+        static void sorted_remove(Block* block, unsigned count, unsigned pos) {
+            std::copy(block->keys_ + pos + 1, block->keys_ + count,
+                      block->keys_ + pos);
+            std::copy(block->children_ + pos + 1, block->children_ + count,
+                      block->children_ + pos);
+        }
+
+        template <class Small, class Large>
+        void copy_sorted(const Small* from, Large* to) const {
+            std::copy(from->keys_, from->keys_ + count_, to->keys_);
+            std::copy(from->children_, from->children_ + count_,
+                      to->children_);
+        }
+
+        void grow(block_pool& pool) {
+            switch (kind_) {
+            case none: {
+                replace_block(pool, allocate<block4>(pool), node4);
+                break;
+            }
+            case node4: {
+                auto block = allocate<block16>(pool);
+                copy_sorted(static_cast<block4*>(block_), block);
+                replace_block(pool, block, node16);
+                break;
+            }
+            case node16: {
+                auto from = static_cast<block16*>(block_);
+                auto block = allocate<block48>(pool);
+                for (unsigned i = 0; i < count_; ++i) {
+                    block->index_[from->keys_[i]] = static_cast<uint8_t>(i + 1);
+                    block->children_[i] = from->children_[i];
+                }
+                replace_block(pool, block, node48);
+                break;
+            }
+            case node48: {
+                auto from = static_cast<block48*>(block_);
+                auto block = allocate<block256>(pool);
+                std::fill(block->children_, block->children_ + 256, no_node);
+                for (unsigned byte = 0; byte < 256; ++byte) {
+                    if (from->index_[byte] != 0) {
+                        block->children_[byte] =
+                            from->children_[from->index_[byte] - 1];
+                    }
+                }
+                replace_block(pool, block, node256);
+                break;
+            }
+            case node256: break;
+            }
+        }
+
+        // Shrink thresholds sit below the grow points so that a node
+        // hovering at a boundary does not flip layouts on every update
+        void shrink(block_pool& pool) {
+            switch (kind_) {
+            case node4: {
+                if (count_ == 0) {
+                    replace_block(pool, nullptr, none);
+                }
+                break;
+            }
+            case node16: {
+                if (count_ <= 3) {
+                    auto block = allocate<block4>(pool);
+                    copy_sorted(static_cast<block16*>(block_), block);
+                    replace_block(pool, block, node4);
+                }
+                break;
+            }
+            case node48: {
+                if (count_ <= 12) {
+                    auto from = static_cast<block48*>(block_);
+                    auto block = allocate<block16>(pool);
+                    unsigned pos = 0;
+                    for (unsigned byte = 0; byte < 256; ++byte) {
+                        if (from->index_[byte] != 0) {
+                            block->keys_[pos] = static_cast<uint8_t>(byte);
+                            block->children_[pos++] =
+                                from->children_[from->index_[byte] - 1];
+                        }
+                    }
+                    replace_block(pool, block, node16);
+                }
+                break;
+            }
+            case node256: {
+                if (count_ <= 37) {
+                    auto from = static_cast<block256*>(block_);
+                    auto block = allocate<block48>(pool);
+                    unsigned pos = 0;
+                    for (unsigned byte = 0; byte < 256; ++byte) {
+                        if (from->children_[byte] != no_node) {
+                            block->children_[pos++] = from->children_[byte];
+                            block->index_[byte] = static_cast<uint8_t>(pos);
+                        }
+                    }
+                    replace_block(pool, block, node48);
+                }
+                break;
+            }
+            case none: break;
+            }
+        }
+
+        // Position of the first child whose byte lies in [from, to],
+        // scanning towards to
+        uint32_t scan(int from, int to) const {
+            int step = from <= to ? 1 : -1;
+
+            switch (kind_) {
+            case node4:
+            case node16: {
+                auto keys = kind_ == node4
+                          ? static_cast<block4*>(block_)->keys_
+                          : static_cast<block16*>(block_)->keys_;
+                int pos = step > 0 ? 0 : count_ - 1;
+                for (; pos >= 0 && pos < count_; pos += step) {
+                    if ((keys[pos] - from) * step >= 0 &&
+                        (to - keys[pos]) * step >= 0) {
+                        return static_cast<uint32_t>(pos);
+                    }
+                }
+                break;
+            }
+            case node48: {
+                auto block = static_cast<block48*>(block_);
+                for (int byte = from; (to - byte) * step >= 0; byte += step) {
+                    if (block->index_[byte] != 0) {
+                        return static_cast<uint32_t>(byte);
+                    }
+                }
+                break;
+            }
+            case node256: {
+                auto block = static_cast<block256*>(block_);
+                for (int byte = from; (to - byte) * step >= 0; byte += step) {
+                    if (block->children_[byte] != no_node) {
+                        return static_cast<uint32_t>(byte);
+                    }
+                }
+                break;
+            }
+            case none: break;
+            }
+
+            return no_node;
+        }
+
+    public:
+        adaptive_children() = default;
+        adaptive_children(adaptive_children&& oth) noexcept
+          : block_(oth.block_)
+          , count_(oth.count_)
+          , kind_(oth.kind_)
+        {
+            oth.block_ = nullptr;
+            oth.count_ = 0;
+            oth.kind_ = none;
+        }
+        adaptive_children& operator=(const adaptive_children&) = delete;
+
+        void assign(block_pool& pool, const adaptive_children& oth) {
+            switch (oth.kind_) {
+            case node4: {
+                auto block = allocate<block4>(pool);
+                *block = *static_cast<const block4*>(oth.block_);
+                replace_block(pool, block, node4);
+                break;
+            }
+            case node16: {
+                auto block = allocate<block16>(pool);
+                *block = *static_cast<const block16*>(oth.block_);
+                replace_block(pool, block, node16);
+                break;
+            }
+            case node48: {
+                auto block = allocate<block48>(pool);
+                *block = *static_cast<const block48*>(oth.block_);
+                replace_block(pool, block, node48);
+                break;
+            }
+            case node256: {
+                auto block = allocate<block256>(pool);
+                *block = *static_cast<const block256*>(oth.block_);
+                replace_block(pool, block, node256);
+                break;
+            }
+            case none: {
+                replace_block(pool, nullptr, none);
+                break;
+            }
+            }
+
+            count_ = oth.count_;
+        }
+
+        void clear(block_pool& pool) {
+            replace_block(pool, nullptr, none);
+            count_ = 0;
+        }
+
+        size_t size() const { return count_; }
+        bool empty() const { return count_ == 0; }
+
+        node_id front() const { return at(scan(0, 255)); }
+        node_id back() const { return at(scan(255, 0)); }
+
+        node_id find(KeyType key_char) const {
+            uint8_t byte = byte_of(key_char);
+
+            switch (kind_) {
+            case node4: {
+                auto block = static_cast<block4*>(block_);
+                for (unsigned i = 0; i < count_; ++i) {
+                    if (block->keys_[i] == byte) {
+                        return block->children_[i];
+                    }
+                }
+                break;
+            }
+            case node16: {
+                auto block = static_cast<block16*>(block_);
+                int pos = search16(block->keys_, count_, byte);
+                if (pos >= 0) {
+                    return block->children_[pos];
+                }
+                break;
+            }
+            case node48: {
+                auto block = static_cast<block48*>(block_);
+                if (block->index_[byte] != 0) {
+                    return block->children_[block->index_[byte] - 1];
+                }
+                break;
+            }
+            case node256: {
+                return static_cast<block256*>(block_)->children_[byte];
+            }
+            case none: break;
+            }
+
+            return no_node;
+        }
+
+        // Positions are slot indices in Node4/16 and key bytes in
+        // Node48/256, so stepping stays inside the block
+        uint32_t position(KeyType key_char) const {
+            uint8_t byte = byte_of(key_char);
+
+            switch (kind_) {
+            case node4: {
+                auto block = static_cast<block4*>(block_);
+                for (unsigned i = 0; i < count_; ++i) {
+                    if (block->keys_[i] == byte) {
+                        return i;
+                    }
+                }
+                break;
+            }
+            case node16: {
+                auto block = static_cast<block16*>(block_);
+                int pos = search16(block->keys_, count_, byte);
+                if (pos >= 0) {
+                    return static_cast<uint32_t>(pos);
+                }
+                break;
+            }
+            case node48: {
+                if (static_cast<block48*>(block_)->index_[byte] != 0) {
+                    return byte;
+                }
+                break;
+            }
+            case node256: {
+                if (static_cast<block256*>(block_)->children_[byte] !=
+                    no_node) {
+                    return byte;
+                }
+                break;
+            }
+            case none: break;
+            }
+
+            return no_node;
+        }
+
+        node_id at(uint32_t pos) const {
+            switch (kind_) {
+            case node4: {
+                return pos < count_
+                     ? static_cast<block4*>(block_)->children_[pos]
+                     : no_node;
+            }
+            case node16: {
+                return pos < count_
+                     ? static_cast<block16*>(block_)->children_[pos]
+                     : no_node;
+            }
+            case node48: {
+                auto block = static_cast<block48*>(block_);
+                return pos < 256 && block->index_[pos] != 0
+                     ? block->children_[block->index_[pos] - 1]
+                     : no_node;
+            }
+            case node256: {
+                return pos < 256
+                     ? static_cast<block256*>(block_)->children_[pos]
+                     : no_node;
+            }
+            case none: break;
+            }
+
+            return no_node;
+        }
+
+        uint32_t first_position() const { return scan(0, 255); }
+        uint32_t last_position() const { return scan(255, 0); }
+
+        uint32_t next_position(uint32_t pos) const {
+            if (kind_ == node4 || kind_ == node16) {
+                return pos + 1 < count_ ? pos + 1 : no_node;
+            }
+
+            return pos < 255 ? scan(static_cast<int>(pos) + 1, 255) : no_node;
+        }
+
+        uint32_t prev_position(uint32_t pos) const {
+            if (kind_ == node4 || kind_ == node16) {
+                return pos == 0 ? no_node : pos - 1;
+            }
+
+            return pos > 0 ? scan(static_cast<int>(pos) - 1, 0) : no_node;
+        }
+
+        void insert(block_pool& pool, KeyType key_char, node_id child) {
+            uint8_t byte = byte_of(key_char);
+
+            if (count_ == capacity()) {
+                grow(pool);
+            }
+
+            switch (kind_) {
+            case node4: {
+                sorted_insert(static_cast<block4*>(block_), count_, byte,
+                              child);
+                break;
+            }
+            case node16: {
+                sorted_insert(static_cast<block16*>(block_), count_, byte,
+                              child);
+                break;
+            }
+            case node48: {
+                auto block = static_cast<block48*>(block_);
+                block->children_[count_] = child;
+                block->index_[byte] = static_cast<uint8_t>(count_ + 1);
+                break;
+            }
+            case node256: {
+                static_cast<block256*>(block_)->children_[byte] = child;
+                break;
+            }
+            case none: break;
+            }
+
+            ++count_;
+        }
+
+        void append(block_pool& pool, KeyType key_char, node_id child) {
+            insert(pool, key_char, child);
+        }
+
+        void remove(block_pool& pool, KeyType key_char) {
+            uint8_t byte = byte_of(key_char);
+
+            switch (kind_) {
+            case node4: {
+                auto block = static_cast<block4*>(block_);
+                auto pos = std::find(block->keys_, block->keys_ + count_, byte);
+                sorted_remove(block, count_, pos - block->keys_);
+                break;
+            }
+            case node16: {
+                auto block = static_cast<block16*>(block_);
+                sorted_remove(block, count_,
+                              search16(block->keys_, count_, byte));
+                break;
+            }
+            case node48: {
+                // Keep slots dense by moving the last one into the hole.
+                // The moved slot is found through the index, not the child.
+                auto block = static_cast<block48*>(block_);
+                unsigned slot = block->index_[byte] - 1;
+                unsigned last = count_ - 1;
+                block->index_[byte] = 0;
+                if (slot != last) {
+                    auto moved = std::find(block->index_, block->index_ + 256,
+                                           static_cast<uint8_t>(last + 1));
+                    *moved = static_cast<uint8_t>(slot + 1);
+                    block->children_[slot] = block->children_[last];
+                }
+                break;
+            }
+            case node256: {
+                static_cast<block256*>(block_)->children_[byte] = no_node;
+                break;
+            }
+            case none: break;
+            }
+
+            --count_;
+
+            // A smaller layout only saves memory, so keep the current one
+            // if it can't be allocated and let removal never throw
+            try {
+                shrink(pool);
+            } catch (...) {
+            }
+        }
+
+        // Adds delta to every stored id
+        void shift_ids(node_id delta) {
+            auto shift = [delta](node_id& id) {
+                if (id != no_node) {
+                    id += delta;
+                }
+            };
+
+            switch (kind_) {
+            case node4: {
+                auto block = static_cast<block4*>(block_);
+                std::for_each(block->children_, block->children_ + count_,
+                              shift);
+                break;
+            }
+            case node16: {
+                auto block = static_cast<block16*>(block_);
+                std::for_each(block->children_, block->children_ + count_,
+                              shift);
+                break;
+            }
+            case node48: {
+                auto block = static_cast<block48*>(block_);
+                std::for_each(block->children_, block->children_ + count_,
+                              shift);
+                break;
+            }
+            case node256: {
+                auto block = static_cast<block256*>(block_);
+                std::for_each(block->children_, block->children_ + 256,
+                              shift);
+                break;
+            }
+            case none: break;
+            }
+        }
+
+        void reserve(block_pool&, size_t) {}
+
+        template <class Function>
+        void for_each(Function func) const {
+            switch (kind_) {
+            case node4: {
+                auto block = static_cast<block4*>(block_);
+                std::for_each(block->children_, block->children_ + count_,
+                              func);
+                break;
+            }
+            case node16: {
+                auto block = static_cast<block16*>(block_);
+                std::for_each(block->children_, block->children_ + count_,
+                              func);
+                break;
+            }
+            case node48: {
+                auto block = static_cast<block48*>(block_);
+                for (unsigned byte = 0; byte < 256; ++byte) {
+                    if (block->index_[byte] != 0) {
+                        func(block->children_[block->index_[byte] - 1]);
+                    }
+                }
+                break;
+            }
+            case node256: {
+                auto block = static_cast<block256*>(block_);
+                for (unsigned byte = 0; byte < 256; ++byte) {
+                    if (block->children_[byte] != no_node) {
+                        func(block->children_[byte]);
+                    }
+                }
+                break;
+            }
+            case none: break;
+            }
+        }
+    };
+
+    typedef typename std::conditional<sizeof(KeyType) == 1,
+                                      adaptive_children,
+                                      sorted_children>::type child_table;
+
+    // Values live out of line in values_, so interior nodes carry no T
+    // and T needs no default constructor. value_ is the node's slot there.
     struct trie_node {
-        std::pair<KeyType, T> data_;
-        bool is_leaf_ = false;
+        KeyType key_{};
+#ifndef TRIE_NO_PARENT_LINKS
+        node_id parent_ = no_node;
+#endif
+        node_id value_ = no_node;
+
+        child_table children_;
+    };
+
+    typedef typename alloc_traits::template rebind_alloc<trie_node>
+        node_allocator;
+
+    // A node on an iterator's path and its position among its siblings,
+    // which is no_node until first needed
+    struct path_step {
+        node_id node_;
+        uint32_t pos_;
+    };
 
-        trie_node* parent_ = nullptr;
-        std::vector<trie_node*> children_;
+    // Released nodes stay in nodes_ and are chained through value_, so
+    // ids handed out later reuse them before the array grows
+    node_id create_node(node_id parent, KeyType key_char) {
+        node_id id = free_;
+
+        if (id != no_node) {
+            free_ = nodes_[id].value_;
+        } else {
+            if (nodes_.size() >= no_node) {
+                throw std::length_error{
+                    "Trie node limit reached"
+                };
+            }
+
+            heights_.push_back(0);
+            try {
+                nodes_.emplace_back();
+            } catch (...) {
+                heights_.pop_back();
+                throw;
+            }
+            id = static_cast<node_id>(nodes_.size() - 1);
+        }
+
+        auto& node = nodes_[id];
+        node.key_ = key_char;
+#ifndef TRIE_NO_PARENT_LINKS
+        node.parent_ = parent;
+#else
+        static_cast<void>(parent);
+#endif
+        node.value_ = no_node;
+        heights_[id] = 0;
+
+        return id;
+    }
+
+    void release_subtree(node_id id) {
+        auto& node = nodes_[id];
+
+        node.children_.for_each([this](node_id child) {
+            release_subtree(child);
+        });
+
+        node.children_.clear(blocks_);
+        if (node.value_ != no_node) {
+            release_value(id);
+        }
+        node.value_ = free_;
+        free_ = id;
+    }
+
+    template <class... Args>
+    void assign_value(node_id id, Args&&... args) {
+        nodes_[id].value_ = values_.emplace(id, std::forward<Args>(args)...);
+    }
+
+    void release_value(node_id id) {
+        values_.erase(nodes_[id].value_);
+        nodes_[id].value_ = no_node;
+    }
+
+    const T* value_of(node_id id) const {
+        node_id slot = nodes_[id].value_;
+
+        return slot == no_node ? nullptr : &values_[slot];
+    }
+
+    void raise_height(node_id id, size_t height) {
+        heights_[id] = std::max(heights_[id], static_cast<uint32_t>(height));
+    }
+
+    // Recomputes heights from the node at depth of path upwards after
+    // its subtree shrank, as long as they keep changing
+    void lower_heights(const std::vector<path_step>& path, size_t depth) {
+        while (true) {
+            node_id id = depth == 0 ? top_id : path[depth - 1].node_;
+            uint32_t height = 0;
+
+            nodes_[id].children_.for_each([&](node_id child) {
+                if (child != end_id) {
+                    height = std::max(height, heights_[child] + 1);
+                }
+            });
+
+            bool changed = height != heights_[id];
+            heights_[id] = height;
+
+            if (!changed || depth == 0) {
+                break;
+            }
+            --depth;
+        }
+    }
+
+    // A key starting with the end marker's key would be stored under the
+    // end marker, where neither find nor iteration can reach it
+    static void check_key(key_view key) {
+        if (key.empty()) {
+            throw std::out_of_range{
+                "Empty key couldn't be added"
+            };
+        }
+        if (key.front() == std::numeric_limits<KeyType>::max()) {
+            throw std::out_of_range{
+                "Key couldn't start with the end marker"
+            };
+        }
+    }
+
+    // A moved-from trie owns no nodes until something is inserted
+    void ensure_root() {
+        if (nodes_.empty()) {
+            create_end_prefix();
+        }
+    }
+
+    // Node id 0 is the root and id 1 is the end marker
+    void create_end_prefix() {
+        create_node(no_node, KeyType{});
+        auto end = create_node(top_id, std::numeric_limits<KeyType>::max());
+
+        nodes_[top_id].children_.append(blocks_, nodes_[end].key_, end);
+    }
+
+    block_pool blocks_;
+    std::vector<trie_node, node_allocator> nodes_;
+    // Length of the longest key below each node, counted from it. Kept
+    // apart so that nodes stay small.
+    std::vector<uint32_t, child_allocator> heights_;
+    value_store values_;
+    node_id free_;
+
+    template <class Iterator>
+    Iterator first_leaf(Iterator iter) const {
+        if (empty()) {
+            return Iterator(iter.trie_, end_id);
+        }
+
+        while (!nodes_[iter.node_].children_.empty()) {
+            iter.descend(nodes_[iter.node_].children_.front());
+        }
+
+        return iter;
+    }
+
+    // Node spelled by length chars below from, or no_node
+    node_id lookup(node_id from, const KeyType* first,
+                   size_t length) const noexcept {
+        for (size_t i = 0; i < length && from != no_node; ++i) {
+            from = nodes_[from].children_.find(first[i]);
+        }
+
+        return from;
+    }
+
+    // Misses are found without building a path
+    template <class Iterator>
+    Iterator find_from(Iterator iter, key_view key) const {
+        auto found = nodes_.empty()
+                   ? no_node
+                   : lookup(top_id, key.data(), key.size());
+
+        if (found == no_node || found == top_id ||
+            nodes_[found].value_ == no_node) {
+            return Iterator(iter.trie_, end_id);
+        }
+
+        return iterator_at(iter, key, found);
+    }
+
+    // Moves iter from the root to id, the node key leads to. Without
+    // parent links the path is walked again into buffers sized once.
+    template <class Iterator>
+    Iterator iterator_at(Iterator iter, key_view key, node_id id) const {
+#ifdef TRIE_NO_PARENT_LINKS
+        static_cast<void>(id);
+        iter.path_.reserve(key.size());
+        iter.key_.reserve(key.size());
+        for (auto key_char : key) {
+            iter.descend(nodes_[iter.node_].children_.find(key_char));
+        }
+#else
+        static_cast<void>(key);
+        iter.node_ = id;
+#endif
+
+        return iter;
+    }
 
+    template <class Iterator>
+    Iterator longest_prefix_from(Iterator iter, key_view query) const {
+        node_id longest = no_node;
+        size_t depth = 0;
 
-        trie_node() = default;
+        for (size_t i = 0; i < query.size() && !nodes_.empty(); ++i) {
+            auto found = nodes_[iter.node_].children_.find(query[i]);
+            if (found == no_node) {
+                break;
+            }
 
-        trie_node(const trie_node& oth)
-          : data_(oth.data_)
-          , is_leaf_(oth.is_leaf_)
-          , parent_(nullptr)
-        {
-            for (const auto& child : oth.children_) {
-                children_.push_back(new trie_node{*child});
-                children_.back()->parent_ = this;
+            iter.descend(found);
+            if (nodes_[found].value_ != no_node) {
+                longest = found;
+                depth = i + 1;
             }
         }
 
-        ~trie_node() {
-            for (auto& child : children_) {
-                delete child;
+        if (longest == no_node) {
+            return Iterator(iter.trie_, end_id);
+        }
+
+#ifdef TRIE_NO_PARENT_LINKS
+        iter.truncate(depth);
+#else
+        static_cast<void>(depth);
+#endif
+        iter.node_ = longest;
+
+        return iter;
+    }
+
+    // Follows the child the node's height comes from, down to a key
+    // of maximal length
+    template <class Iterator>
+    Iterator longest_below(Iterator iter) const {
+        while (heights_[iter.node_] != 0) {
+            const auto& table = nodes_[iter.node_].children_;
+            auto pos = table.first_position();
+
+            while (table.at(pos) == end_id ||
+                   heights_[table.at(pos)] + 1 != heights_[iter.node_]) {
+                pos = table.next_position(pos);
             }
+            iter.descend(table.at(pos));
         }
 
-        void remove_child(trie_node* child_to_remove) {
-            auto found = std::find(children_.begin(), children_.end(),
-                                   child_to_remove);
+        return iter;
+    }
 
-            children_.erase(found);
-            delete child_to_remove;
+    template <class Iterator>
+    Iterator longest_with_prefix_from(Iterator iter, key_view prefix) const {
+        if (empty()) {
+            return Iterator(iter.trie_, end_id);
         }
 
-        auto find_by_key(KeyType key_char) {
-            auto left = children_.begin();
-            auto right = children_.end();
+        for (auto key_char : prefix) {
+            auto found = nodes_[iter.node_].children_.find(key_char);
+            if (found == no_node) {
+                return Iterator(iter.trie_, end_id);
+            }
+            iter.descend(found);
+        }
 
-            while (left < right) {
-                auto mid = left + std::distance(left, right)/2;
+        return longest_below(iter);
+    }
 
-                if ((*mid)->data_.first == key_char) {
-                    return mid;
+    // Expects an empty trie. Every key extends the path of the previous
+    // one, so children are appended in order with no lookups and nodes
+    // are laid out in key order. Byte keys may also come in the unsigned
+    // order of std::string, as adaptive tables insert children in place;
+    // either order has to hold for the whole input.
+    template <class InputIt>
+    void append_sorted(InputIt first, InputIt last) {
+        constexpr auto end_key = std::numeric_limits<KeyType>::max();
+        nodes_[top_id].children_.remove(blocks_, end_key);
+
+        std::vector<node_id> path;
+        key_string previous;
+        bool in_key_order = true;
+        bool in_traits_order = sizeof(KeyType) == 1;
+
+        for (; first != last; ++first) {
+            auto&& item = *first;
+            const key_string& key = item.first;
+
+            check_key(key);
+            if (!previous.empty()) {
+                in_key_order = in_key_order &&
+                               std::lexicographical_compare(
+                                   previous.begin(), previous.end(),
+                                   key.begin(), key.end());
+                in_traits_order = in_traits_order && previous < key;
+
+                if (!in_key_order && !in_traits_order) {
+                    throw std::invalid_argument{
+                        "Keys must be sorted and unique"
+                    };
                 }
+            }
 
-                if ((*mid)->data_.first > key_char) {
-                    right = mid;
-                } else {
-                    left = mid + 1;
-                }
+            size_t depth = std::mismatch(previous.begin(), previous.end(),
+                                         key.begin(), key.end()).first -
+                           previous.begin();
+            path.resize(depth);
+
+            raise_height(top_id, key.size());
+            for (size_t i = 0; i < depth; ++i) {
+                raise_height(path[i], key.size() - i - 1);
+            }
+
+            node_id node = depth == 0 ? top_id : path.back();
+            for (size_t i = depth; i < key.size(); ++i) {
+                auto child = create_node(node, key[i]);
+
+                nodes_[node].children_.append(blocks_, key[i], child);
+                raise_height(child, key.size() - i - 1);
+                path.push_back(child);
+                node = child;
             }
 
-            return children_.end();
+            assign_value(node, std::forward<decltype(item)>(item).second);
+            previous = key;
         }
 
-        void push_child(trie_node* child) {
-            children_.push_back(child);
+        nodes_[top_id].children_.append(blocks_, end_key, end_id);
+    }
 
-            for (auto r_iter = children_.rbegin(),
-                 next_r_iter = r_iter + 1;
-                 next_r_iter != children_.rend();
-                 ++r_iter, ++next_r_iter) {
-                if ((*r_iter)->data_.first >
-                    (*next_r_iter)->data_.first) {
-                    break;
-                }
-                std::iter_swap(r_iter, next_r_iter);
+    // Moves all nodes and values of source, which must have no released
+    // nodes, into this trie. Every key in source has to sort after the
+    // keys stored here, so the two can only share the path to the last
+    // key stored here; the source's nodes on it are merged into ours.
+    void adopt(trie& source) {
+        constexpr auto end_key = std::numeric_limits<KeyType>::max();
+        size_t count = source.nodes_.size() - 2;
+
+        if (count > no_node - nodes_.size()) {
+            throw std::length_error{
+                "Trie node limit reached"
+            };
+        }
+
+        // Ids in source start after the root and the end marker
+        auto delta = static_cast<node_id>(nodes_.size() - 2);
+        nodes_.reserve(nodes_.size() + count);
+        heights_.reserve(heights_.size() + count);
+        // Child blocks and value chunks of source stay where they are
+        blocks_.adopt(source.blocks_);
+        auto value_delta = values_.adopt(source.values_, delta);
+
+        for (size_t id = 2; id < source.nodes_.size(); ++id) {
+            nodes_.push_back(std::move(source.nodes_[id]));
+            heights_.push_back(source.heights_[id]);
+
+            auto& node = nodes_.back();
+#ifndef TRIE_NO_PARENT_LINKS
+            if (node.parent_ != top_id) {
+                node.parent_ += delta;
             }
+#endif
+            if (node.value_ != no_node) {
+                node.value_ += value_delta;
+            }
+            node.children_.shift_ids(delta);
         }
-    };
 
-    void create_end_prefix() const {
-        auto end = new trie_node;
+        raise_height(top_id, source.heights_[top_id]);
+        nodes_[top_id].children_.remove(blocks_, end_key);
+
+        std::vector<node_id> incoming;
+        source.nodes_[top_id].children_.for_each([&](node_id child) {
+            if (child != end_id) {
+                incoming.push_back(child + delta);
+            }
+        });
+
+        // A first incoming child with the key of our last child spells
+        // the same prefix: its children are merged one level down
+        node_id into = top_id;
+        while (!incoming.empty()) {
+            const auto& table = nodes_[into].children_;
+            node_id first = incoming.front();
+            node_id last = table.empty() ? no_node : table.back();
+            bool merge = last != no_node &&
+                         nodes_[last].key_ == nodes_[first].key_;
+
+            for (size_t i = merge ? 1 : 0; i < incoming.size(); ++i) {
+                nodes_[into].children_.append(blocks_,
+                                              nodes_[incoming[i]].key_,
+                                              incoming[i]);
+#ifndef TRIE_NO_PARENT_LINKS
+                nodes_[incoming[i]].parent_ = into;
+#endif
+            }
+            if (!merge) {
+                break;
+            }
+
+            auto& merged = nodes_[first];
+            raise_height(last, heights_[first]);
+            if (merged.value_ != no_node) {
+                nodes_[last].value_ = merged.value_;
+                values_.set_owner(merged.value_, last);
+            }
 
-        end->data_.first = std::numeric_limits<KeyType>::max();
-        end->parent_ = top_;
-        end->is_leaf_ = true;
+            incoming.clear();
+            merged.children_.for_each([&](node_id child) {
+                incoming.push_back(child);
+            });
+            merged.children_.clear(blocks_);
+            merged.value_ = free_;
+            free_ = first;
+            into = last;
+        }
 
-        top_->children_.push_back(end);
+        nodes_[top_id].children_.append(blocks_, end_key, end_id);
+        source.clear();
     }
 
-    trie_node* top_;
-    size_t size_;
+    template <class, class> friend class frozen_trie;
+    template <class, class> friend class louds_trie;
+    template <class, class> friend class dawg;
+    template <class, class, class> friend class aho_corasick;
 
 public:
-    struct search_iterator {
-    private:
-        trie_node* node_;
+    template <class Value>
+    using basic_entry = trie_detail::entry<KeyType, Value>;
 
+    template <bool IsConst>
+    struct basic_iterator {
     public:
-        explicit search_iterator(trie_node* ptr)
-          : node_(ptr)
-        {}
+        typedef typename std::conditional<IsConst, const T, T>::type
+            mapped_reference_type;
 
-        search_iterator& operator=(
-                const trie<T, KeyType>::search_iterator& rhs
-        ) {
-            node_ = rhs.node_;
-            return *this;
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<key_string, T> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef basic_entry<mapped_reference_type> reference;
+
+        struct pointer {
+            reference entry_;
+
+            const reference* operator->() const { return &entry_; }
+        };
+
+    private:
+        typedef typename std::conditional<IsConst, const trie, trie>::type
+            owner_type;
+
+        owner_type* trie_;
+        node_id node_;
+        // Steps from a child of the root down to node_ and the key they
+        // spell. Kept up to date without parent links, filled on first
+        // use otherwise.
+        mutable std::vector<path_step> path_;
+        mutable key_string key_;
+
+        const trie_node& node(node_id id) const {
+            return trie_->nodes_[id];
+        }
+
+        // The end marker stops traversal like a node with a value
+        bool is_leaf(node_id id) const {
+            return id == end_id || node(id).value_ != no_node;
+        }
+
+        const child_table& siblings(size_t depth) const {
+            return node(depth == 0 ? top_id : path_[depth - 1].node_)
+                .children_;
+        }
+
+        // Position of the step at depth, looked up again only if the
+        // sibling table changed since it was recorded
+        uint32_t position(size_t depth) {
+            auto& step = path_[depth];
+            const auto& table = siblings(depth);
+
+            if (table.at(step.pos_) != step.node_) {
+                step.pos_ = table.position(node(step.node_).key_);
+            }
+
+            return step.pos_;
+        }
+
+        void push_step(node_id id, uint32_t pos) const {
+            path_.push_back({id, pos});
+            key_.push_back(node(id).key_);
+        }
+
+        void replace_step(size_t depth, node_id id, uint32_t pos) {
+            path_[depth] = {id, pos};
+            key_[depth] = node(id).key_;
+        }
+
+        void truncate(size_t depth) {
+            path_.resize(depth);
+            key_.resize(depth);
         }
 
-        const T& value() const {
-            return node_->data_.second;
+        void descend(node_id id) {
+#ifndef TRIE_NO_PARENT_LINKS
+            if (!path_.empty())
+#endif
+                push_step(id, no_node);
+            node_ = id;
         }
-        T& value() {
-            return node_->data_.second;
+
+        void descend_front() {
+            while (!node(path_.back().node_).children_.empty()) {
+                const auto& table = node(path_.back().node_).children_;
+                auto pos = table.first_position();
+                push_step(table.at(pos), pos);
+            }
         }
 
-        key_string key() const {
-            key_string key_str;
+        void descend_back() {
+            while (!is_leaf(path_.back().node_)) {
+                const auto& table = node(path_.back().node_).children_;
+                auto pos = table.last_position();
+                push_step(table.at(pos), pos);
+            }
+        }
 
-            trie_node* node = node_;
-            while (node->parent_ != nullptr) {
-                key_str = node->data_.first + key_str;
-                node = node->parent_;
+        void materialize() const {
+            if (!path_.empty()) {
+                return;
+            }
+#ifndef TRIE_NO_PARENT_LINKS
+            for (node_id id = node_; id != top_id; id = node(id).parent_) {
+                push_step(id, no_node);
             }
+            std::reverse(path_.begin(), path_.end());
+            std::reverse(key_.begin(), key_.end());
+#else
+            if (node_ == end_id) {
+                push_step(end_id, no_node);
+            }
+#endif
+        }
 
-            return key_str;
+        basic_iterator(owner_type* owner, node_id id)
+          : trie_(owner)
+          , node_(id)
+        {}
+
+    public:
+        basic_iterator()
+          : trie_(nullptr)
+          , node_(no_node)
+        {}
+
+        // Iterators convert to const iterators
+        template <bool WasConst, class = typename std::enable_if<
+                                     IsConst && !WasConst>::type>
+        basic_iterator(const basic_iterator<WasConst>& oth)
+          : trie_(oth.trie_)
+          , node_(oth.node_)
+          , path_(oth.path_)
+          , key_(oth.key_)
+        {}
+
+        // Valid until the key is erased
+        mapped_reference_type& value() const {
+            return trie_->values_[node(node_).value_];
+        }
+
+        // Valid until the iterator is moved
+        std::basic_string_view<KeyType> key() const {
+            materialize();
+
+            return key_;
         }
 
-        void advance(const key_string& sub_key) {
+        void advance(key_view sub_key) {
             if (sub_key.empty()) {
                 throw std::invalid_argument{
                     "Advance with zero prefix"
                 };
             }
 
-            auto sub_iter = sub_key.cbegin();
-            trie_node* node = node_;
+            node_id start = node_;
+            size_t depth = path_.size();
+
+            for (auto key_char : sub_key) {
+                auto found = node(node_).children_.find(key_char);
+                if (found == no_node) {
+                    node_ = start;
+                    truncate(depth);
 
-            while (sub_iter != sub_key.cend()) {
-                auto found = node->find_by_key(*sub_iter);
-                if (found == node->children_.cend()) {
                     throw std::runtime_error{
                         "No such prefix"
                     };
                 }
-                node = *found;
-                ++sub_iter;
+                descend(found);
+            }
+        }
+
+        // Same as advance, but leaves the iterator as it was and returns
+        // false instead of throwing
+        bool try_advance(key_view sub_key) noexcept {
+            if (sub_key.empty()) {
+                return false;
+            }
+
+            auto target = trie_->lookup(node_, sub_key.data(), sub_key.size());
+            if (target == no_node) {
+                return false;
+            }
+
+#ifndef TRIE_NO_PARENT_LINKS
+            // The path is rebuilt from parent links when needed
+            path_.clear();
+            key_.clear();
+            node_ = target;
+#else
+            try {
+                path_.reserve(path_.size() + sub_key.size());
+                key_.reserve(key_.size() + sub_key.size());
+            } catch (...) {
+                return false;
+            }
+
+            for (auto key_char : sub_key) {
+                descend(node(node_).children_.find(key_char));
             }
+#endif
 
-            node_->is_leaf_ = false;
-            node_ = node;
-            node_->is_leaf_ = true;
+            return true;
         }
 
-        std::pair<std::basic_string<KeyType>, T> operator*() const {
-            return std::make_pair(key(), node_->data_.second);
+        reference operator*() const {
+            return {key(), value()};
         }
-        std::pair<std::basic_string<KeyType>, T> operator*() {
-            return const_cast<const search_iterator*>(this)->operator*();
+        pointer operator->() const {
+            return {operator*()};
         }
 
         // Arithmetical operators
-        search_iterator operator++() {
-            if (node_->data_.first == std::numeric_limits<KeyType>::max()) {
+        basic_iterator& operator++() {
+            if (node_ == end_id) {
                 throw std::out_of_range{
                     "Iterator to end couldn't be incremented"
                 };
             }
 
-            trie_node* node = node_;
+            materialize();
 
             while (true) {
-                if (node->is_leaf_ && node != node_) {
-                    return *this = search_iterator(node);
-                }
+                size_t depth = path_.size() - 1;
+                const auto& table = siblings(depth);
+                auto next = table.next_position(position(depth));
 
-                if (node->parent_->children_.size() > 1) {
-                    auto next_child =
-                             ++(node->parent_->find_by_key(node->data_.first));
-
-                    if (next_child == node->parent_->children_.end()) {
-                        node = node->parent_;
-                    } else {
-                        node = *next_child;
-                        break;
-                    }
-                } else {
-                    node = node->parent_;
+                if (next != no_node) {
+                    replace_step(depth, table.at(next), next);
+                    descend_front();
+                    break;
                 }
-            }
 
-            while (true) {
-                if (node->is_leaf_ && node->children_.empty()) {
-                    return *this = search_iterator(node);
+                // The end marker follows every other child of the root,
+                // so the path never runs out here
+                truncate(depth);
+                if (is_leaf(path_.back().node_)) {
+                    break;
                 }
-
-                node = node->children_.front();
             }
+
+            node_ = path_.back().node_;
+            return *this;
         }
-        const search_iterator operator++(int) {
-            search_iterator old_state(*this);
+        basic_iterator operator++(int) {
+            basic_iterator old_state(*this);
             operator++();
             return old_state;
         }
 
-        search_iterator operator--() {
-            trie_node* node = node_;
+        basic_iterator& operator--() {
+            materialize();
 
-            // Shift down
-            if (!node->children_.empty()) {
-                while (true) {
-                    if (node->is_leaf_ && node != node_) {
-                        return *this = search_iterator(node);
-                    }
+            if (!node(node_).children_.empty()) {
+                const auto& table = node(node_).children_;
+                auto pos = table.last_position();
+                push_step(table.at(pos), pos);
+            } else {
+                size_t depth = path_.size();
+                uint32_t prev = no_node;
 
-                    node = node->children_.back();
+                while (depth > 0 && prev == no_node) {
+                    --depth;
+                    prev = siblings(depth).prev_position(position(depth));
                 }
-            }
 
-            // Shift left
-            while (true) {
-                if (node->parent_ == nullptr) {
+                if (prev == no_node) {
                     throw std::out_of_range{
                         "Begin iterator couldn't be decremented"
                     };
                 }
 
-                if (node->parent_->children_.size() > 1) {
-                    auto prev_child =
-                            node->parent_->find_by_key(node->data_.first);
-
-                    if (prev_child == node->parent_->children_.begin()) {
-                        node = node->parent_;
-                    } else {
-                        node = *(--prev_child);
-                        break;
-                    }
-                } else {
-                    node = node->parent_;
-                }
+                truncate(depth + 1);
+                replace_step(depth, siblings(depth).at(prev), prev);
             }
 
-            // Shift down
-            while (true) {
-                if (node->is_leaf_ && node != node_) {
-                    return *this = search_iterator(node);
-                }
+            descend_back();
 
-                node = node->children_.back();
-            }
+            node_ = path_.back().node_;
+            return *this;
         }
-        const search_iterator operator--(int) {
+        basic_iterator operator--(int) {
             auto old_state(*this);
             operator--();
             return old_state;
         }
 
-        bool operator==(const trie<T, KeyType>::search_iterator& rhs) const {
+        template <bool RhsConst>
+        bool operator==(const basic_iterator<RhsConst>& rhs) const {
             return node_ == rhs.node_;
         }
-        bool operator!=(const trie<T, KeyType>::search_iterator& rhs) const {
+        template <bool RhsConst>
+        bool operator!=(const basic_iterator<RhsConst>& rhs) const {
             return node_ != rhs.node_;
         }
 
+        template <bool> friend struct basic_iterator;
         friend trie;
     };
 
+    typedef basic_iterator<false> iterator;
+    typedef basic_iterator<true> const_iterator;
+    typedef iterator search_iterator;
+
+    typedef Allocator allocator_type;
+
     trie()
-      : size_(0)
+      : trie(Allocator())
+    {}
+
+    explicit trie(const Allocator& alloc)
+      : blocks_(alloc)
+      , nodes_(node_allocator(alloc))
+      , heights_(child_allocator(alloc))
+      , values_(alloc)
+      , free_(no_node)
     {
-        top_ = new trie_node;
-        top_->is_leaf_ = false;
-        top_->parent_ = nullptr;
-
         create_end_prefix();
     }
 
+    // Builds from unique key/value pairs sorted character by character
+    // as KeyType values, or for byte keys also as std::string sorts them
+    template <class InputIt>
+    trie(InputIt first, InputIt last, const Allocator& alloc = Allocator())
+      : trie(alloc)
+    {
+        append_sorted(first, last);
+    }
+
     trie(const trie& oth)
-      : size_(oth.size_)
+      : trie(oth, alloc_traits::select_on_container_copy_construction(
+                      oth.get_allocator()))
+    {}
+
+    // Ids are kept as they are, so the copy is a single pass over the
+    // node array with no tree walk
+    trie(const trie& oth, const Allocator& alloc)
+      : blocks_(alloc)
+      , nodes_(node_allocator(alloc))
+      , heights_(oth.heights_, child_allocator(alloc))
+      , values_(oth.values_, alloc)
+      , free_(oth.free_)
+    {
+        nodes_.reserve(oth.nodes_.size());
+
+        for (const auto& src : oth.nodes_) {
+            nodes_.emplace_back();
+
+            auto& node = nodes_.back();
+            node.key_ = src.key_;
+#ifndef TRIE_NO_PARENT_LINKS
+            node.parent_ = src.parent_;
+#endif
+            node.value_ = src.value_;
+            node.children_.assign(blocks_, src.children_);
+        }
+    }
+
+    // The source is left empty and owns no nodes
+    trie(trie&& oth) noexcept
+      : blocks_(std::move(oth.blocks_))
+      , nodes_(std::move(oth.nodes_))
+      , heights_(std::move(oth.heights_))
+      , values_(std::move(oth.values_))
+      , free_(oth.free_)
     {
-        top_ = new trie_node{*oth.top_};
+        oth.nodes_.clear();
+        oth.heights_.clear();
+        oth.free_ = no_node;
     }
 
-    ~trie() {
-        delete top_;
+    trie(trie&& oth, const Allocator& alloc)
+      : trie(alloc)
+    {
+        if (alloc == oth.get_allocator()) {
+            swap(oth);
+        } else {
+            trie copy{oth, alloc};
+            swap(copy);
+        }
     }
 
-    trie& operator=(const trie<T>& rhs) {
+    trie& operator=(const trie& rhs) {
         if (this != &rhs) {
-            auto new_top = new trie_node{*rhs.top_};
+            trie copy{rhs, get_allocator()};
+            swap(copy);
+        }
+
+        return *this;
+    }
 
-            std::swap(top_, new_top);
-            delete new_top;
+    // Child blocks come from a pool made with the allocator, so the
+    // arrays can only be taken over whole when that allocator may come
+    // along
+    trie& operator=(trie&& rhs) noexcept(
+        alloc_traits::propagate_on_container_move_assignment::value ||
+        alloc_traits::is_always_equal::value) {
+        if (this == &rhs) {
+            return *this;
+        }
 
-            size_ = rhs.size();
+        if constexpr (
+            alloc_traits::propagate_on_container_move_assignment::value) {
+            nodes_ = std::move(rhs.nodes_);
+            heights_ = std::move(rhs.heights_);
+            blocks_ = std::move(rhs.blocks_);
+            values_ = std::move(rhs.values_);
+            free_ = rhs.free_;
+
+            rhs.nodes_.clear();
+            rhs.heights_.clear();
+            rhs.free_ = no_node;
+        } else if (get_allocator() == rhs.get_allocator()) {
+            trie moved{std::move(rhs)};
+            swap(moved);
+        } else {
+            trie copy{rhs, get_allocator()};
+            swap(copy);
         }
 
         return *this;
     }
 
-    search_iterator begin() const {
-        if (empty()) {
-            return end();
+    iterator begin() {
+        return first_leaf(iterator(this, top_id));
+    }
+    const_iterator begin() const {
+        return first_leaf(const_iterator(this, top_id));
+    }
+    const_iterator cbegin() const {
+        return begin();
+    }
+
+    iterator end() {
+        return iterator(this, end_id);
+    }
+    const_iterator end() const {
+        return const_iterator(this, end_id);
+    }
+    const_iterator cend() const {
+        return end();
+    }
+
+    allocator_type get_allocator() const {
+        return Allocator(nodes_.get_allocator());
+    }
+
+    size_t size() const { return values_.size(); }
+    bool empty() const { return values_.empty(); }
+
+    // Stored values are kept; the flag tells whether data was inserted
+    std::pair<iterator, bool> insert(const std::pair<key_string, T>& data) {
+        return try_emplace(data.first, data.second);
+    }
+    std::pair<iterator, bool> insert(std::pair<key_string, T>&& data) {
+        return try_emplace(data.first, std::move(data.second));
+    }
+
+    // Constructs the value in place from args if key is not stored yet.
+    // Otherwise nothing happens and args are left untouched.
+    template <class... Args>
+    std::pair<iterator, bool> try_emplace(key_view key, Args&&... args) {
+        auto place = locate(key);
+        bool inserted = nodes_[place.node_].value_ == no_node;
+
+        if (inserted) {
+            emplace_value(key, place, std::forward<Args>(args)...);
         }
 
-        trie_node* node = top_;
+        return {iterator_at(iterator(this, top_id), key, place.node_),
+                inserted};
+    }
+
+    // Keys are not stored as such, so this is the same as try_emplace
+    template <class... Args>
+    std::pair<iterator, bool> emplace(key_view key, Args&&... args) {
+        return try_emplace(key, std::forward<Args>(args)...);
+    }
+
+    template <class Value>
+    std::pair<iterator, bool> insert_or_assign(key_view key, Value&& value) {
+        auto place = locate(key);
+        bool inserted = nodes_[place.node_].value_ == no_node;
 
-        while (!node->children_.empty()) {
-            node = node->children_.front();
+        if (inserted) {
+            emplace_value(key, place, std::forward<Value>(value));
+        } else {
+            values_[nodes_[place.node_].value_] = std::forward<Value>(value);
         }
 
-        return search_iterator(node);
+        return {iterator_at(iterator(this, top_id), key, place.node_),
+                inserted};
     }
 
-    search_iterator end() const {
-        return search_iterator{top_->children_.back()};
+    // Stores init under key if it is missing and calls combine(value,
+    // init) on the stored value otherwise, walking key only once
+    template <class Value, class Combine>
+    std::pair<iterator, bool> upsert(key_view key, Value&& init,
+                                     Combine combine) {
+        auto place = locate(key);
+        bool inserted = nodes_[place.node_].value_ == no_node;
+
+        if (inserted) {
+            emplace_value(key, place, std::forward<Value>(init));
+        } else {
+            combine(values_[nodes_[place.node_].value_],
+                    std::forward<Value>(init));
+        }
+
+        return {iterator_at(iterator(this, top_id), key, place.node_),
+                inserted};
     }
 
-    size_t size() const { return size_; }
-    bool empty() const { return top_->children_.size() == 1; }
+    // Value-initializes missing values. No iterator is built.
+    T& operator[](key_view key) {
+        auto place = locate(key);
 
-    search_iterator insert(const std::pair<key_string, T>& data) {
-        if (data.first.empty()) {
-            throw std::out_of_range{
-                "Empty key couldn't be added"
-            };
+        if (nodes_[place.node_].value_ == no_node) {
+            emplace_value(key, place);
         }
 
-        auto str_iter = data.first.cbegin();
+        return values_[nodes_[place.node_].value_];
+    }
 
-        auto found = top_->find_by_key(*str_iter);
-        trie_node* node = top_;
+    // Replaces the contents with sorted unique key/value pairs in a
+    // single pass. Nothing changes if the input is out of order.
+    template <class InputIt>
+    void bulk_load(InputIt first, InputIt last) {
+        trie loaded(first, last, get_allocator());
+        swap(loaded);
+    }
 
-        if (found != top_->children_.end()) {
-            ++str_iter;
-            node = *found;
+    // Builds from unique key/value pairs in any order. Pairs are split
+    // into one share of neighbouring keys per worker thread, at bounds
+    // taken from a sample of the keys, so shares stay even when most
+    // keys have a common prefix. Each worker sorts its share. With a
+    // stateless allocator, which then has to be thread-safe, workers
+    // also bulk load their shares into tries with their own node arrays
+    // that are spliced together. A stateful allocator, such as a pmr
+    // resource, is only used by the calling thread, which loads the
+    // sorted shares one after another. threads == 0 uses the hardware
+    // concurrency.
+    template <class InputIt>
+    static trie build_parallel(InputIt first, InputIt last,
+                               unsigned threads = 0,
+                               const Allocator& alloc = Allocator()) {
+        typedef std::pair<key_string, T> item_type;
+        constexpr bool parallel_load =
+            alloc_traits::is_always_equal::value;
+
+        if (threads == 0) {
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        }
 
-            while (true) {
-                if (str_iter == data.first.cend()) {
-                    if (!node->is_leaf_) {
-                        node->data_.second = data.second;
-                        node->is_leaf_ = true;
+        auto key_less = [](const key_string& lhs, const key_string& rhs) {
+            return std::lexicographical_compare(lhs.begin(), lhs.end(),
+                                                rhs.begin(), rhs.end());
+        };
 
-                        ++size_;
+        std::vector<item_type> items(first, last);
+        for (const auto& item : items) {
+            check_key(item.first);
+        }
 
-                        return search_iterator(node);
-                    }
+        // Keys where the shares after the first start
+        std::vector<key_string> bounds;
+        if (threads > 1 && !items.empty()) {
+            size_t step = std::max<size_t>(1, items.size() / threads / 64);
+            std::vector<key_string> sample;
 
-                    throw std::out_of_range{
-                        "Key already exists"
-                    };
+            for (size_t i = 0; i < items.size(); i += step) {
+                sample.push_back(items[i].first);
+            }
+            std::sort(sample.begin(), sample.end(), key_less);
+
+            for (size_t i = 1; i < threads; ++i) {
+                const auto& bound = sample[i * sample.size() / threads];
+                if (bounds.empty() || key_less(bounds.back(), bound)) {
+                    bounds.push_back(bound);
                 }
+            }
+        }
 
-                found = node->find_by_key(*str_iter);
-                if (found == node->children_.end()) {
-                    break;
+        std::vector<std::vector<item_type>> parts(bounds.size() + 1);
+        for (auto& item : items) {
+            size_t part = std::upper_bound(bounds.begin(), bounds.end(),
+                                           item.first, key_less) -
+                          bounds.begin();
+            parts[part].push_back(std::move(item));
+        }
+        items = std::vector<item_type>{};
+
+        std::vector<trie> built;
+        if (parallel_load) {
+            built.reserve(parts.size());
+            for (size_t i = 0; i < parts.size(); ++i) {
+                built.emplace_back(alloc);
+            }
+        }
+
+        std::vector<std::exception_ptr> errors(parts.size());
+        auto build = [&](size_t i) {
+            try {
+                auto& part = parts[i];
+                std::sort(part.begin(), part.end(),
+                          [&](const item_type& lhs, const item_type& rhs) {
+                              return key_less(lhs.first, rhs.first);
+                          });
+                if (parallel_load) {
+                    built[i].bulk_load(std::make_move_iterator(part.begin()),
+                                       std::make_move_iterator(part.end()));
+                    part = std::vector<item_type>{};
                 }
+            } catch (...) {
+                errors[i] = std::current_exception();
+            }
+        };
 
-                ++str_iter;
-                node = *found;
+        // The calling thread builds the first share itself
+        std::vector<std::thread> workers;
+        try {
+            for (size_t i = 1; i < parts.size(); ++i) {
+                workers.emplace_back(build, i);
+            }
+        } catch (...) {
+            for (auto& worker : workers) {
+                worker.join();
             }
+            throw;
+        }
+
+        build(0);
+        for (auto& worker : workers) {
+            worker.join();
         }
 
-        while (str_iter != data.first.cend()) {
-            auto new_child = new trie_node{};
-            new_child->parent_ = node;
-            new_child->is_leaf_ = false;
-            new_child->data_.first = *str_iter;
+        for (const auto& error : errors) {
+            if (error) {
+                std::rethrow_exception(error);
+            }
+        }
 
-            node->push_child(new_child);
+        if (!parallel_load) {
+            for (auto& part : parts) {
+                std::move(part.begin(), part.end(),
+                          std::back_inserter(items));
+                part = std::vector<item_type>{};
+            }
 
-            node = new_child;
+            return trie(std::make_move_iterator(items.begin()),
+                        std::make_move_iterator(items.end()), alloc);
+        }
 
-            ++str_iter;
+        trie result(alloc);
+        for (auto& part : built) {
+            result.adopt(part);
         }
 
-        node->is_leaf_ = true;
-        node->data_.second = data.second;
+        return result;
+    }
+
+    void erase(const_iterator iter) {
+        if (!nodes_[iter.node_].children_.empty()) {
+            release_value(iter.node_);
 
-        ++size_;
+            return;
+        }
 
-        return search_iterator{node};
+        prune(iter);
     }
 
-    void erase(search_iterator iter) {
-        if (!iter.node_->children_.empty()) {
-            iter.node_->is_leaf_ = false;
+    void swap(trie& oth) {
+        using std::swap;
 
-            --size_;
+        blocks_.swap(oth.blocks_);
+        nodes_.swap(oth.nodes_);
+        heights_.swap(oth.heights_);
+        values_.swap(oth.values_);
+        swap(free_, oth.free_);
+    }
 
-            return;
+    void clear() {
+        nodes_.clear();
+        heights_.clear();
+        blocks_.release();
+        values_.release();
+        free_ = no_node;
+        create_end_prefix();
+    }
+
+    iterator find(key_view key) {
+        return find_from(iterator(this, top_id), key);
+    }
+    const_iterator find(key_view key) const {
+        return find_from(const_iterator(this, top_id), key);
+    }
+
+    // Value stored under key, or nullptr
+    T* try_find(key_view key) noexcept {
+        return const_cast<T*>(std::as_const(*this).try_find(key));
+    }
+    const T* try_find(key_view key) const noexcept {
+        if (nodes_.empty()) {
+            return nullptr;
         }
 
-        trie_node* node = iter.node_;
+        auto found = lookup(top_id, key.data(), key.size());
+        if (found == no_node || found == top_id) {
+            return nullptr;
+        }
+
+        return value_of(found);
+    }
+
+    bool get_value(key_view prefix, T& container) const {
+        auto found_iter = find(prefix);
 
-        while (!node->parent_->is_leaf_ &&
-               node->parent_->children_.size() <= 1 &&
-               node->parent_ != nullptr) {
-            node = node->parent_;
+        if (found_iter == end()) {
+            return false;
         }
 
-        node->parent_->remove_child(node);
+        container = found_iter.value();
 
-        --size_;
+        return true;
     }
 
-    void swap(trie<T, KeyType>& oth) {
-        using std::swap;
+    // Longest stored key that is a prefix of query, found in a single
+    // walk down the query
+    iterator longest_prefix_of(key_view query) {
+        return longest_prefix_from(iterator(this, top_id), query);
+    }
+    const_iterator longest_prefix_of(key_view query) const {
+        return longest_prefix_from(const_iterator(this, top_id), query);
+    }
 
-        swap(top_, oth.top_);
-        swap(size_, oth.size_);
+    // Calls func(key, value) for every stored key that is a prefix of
+    // query, shortest first, in a single walk down the query
+    template <class Function>
+    void for_each_prefix_of(key_view query, Function func) {
+        std::as_const(*this).for_each_prefix_of(
+            query, [&](key_view key, const T& value) {
+                func(key, const_cast<T&>(value));
+            });
     }
+    template <class Function>
+    void for_each_prefix_of(key_view query, Function func) const {
+        node_id node = top_id;
+
+        for (size_t i = 0; i < query.size() && !nodes_.empty(); ++i) {
+            node = nodes_[node].children_.find(query[i]);
+            if (node == no_node) {
+                break;
+            }
 
-    void clear() {
-        for (auto& it : top_->children_) {
-            delete it;
+            if (auto value = value_of(node)) {
+                func(query.substr(0, i + 1), *value);
+            }
         }
+    }
 
-        top_->children_.clear();
-        create_end_prefix();
+    // Writes an entry per stored prefix of query to out, shortest first.
+    // The keys are views into query.
+    template <class OutputIt>
+    OutputIt prefixes_of(key_view query, OutputIt out) const {
+        for_each_prefix_of(query, [&](key_view key, const T& value) {
+            *out = typename const_iterator::reference{key, value};
+            ++out;
+        });
+
+        return out;
+    }
+
+    // Longest key, the first one in iteration order on ties
+    iterator find_longest_prefix() {
+        return longest_with_prefix_from(iterator(this, top_id), key_view{});
+    }
+    const_iterator find_longest_prefix() const {
+        return longest_with_prefix_from(const_iterator(this, top_id),
+                                        key_view{});
+    }
 
-        size_ = 0;
+    // Longest key starting with prefix
+    iterator find_longest_with_prefix(key_view prefix) {
+        return longest_with_prefix_from(iterator(this, top_id), prefix);
     }
+    const_iterator find_longest_with_prefix(key_view prefix) const {
+        return longest_with_prefix_from(const_iterator(this, top_id),
+                                        prefix);
+    }
+
+private:
+    // Removes the leaf at iter together with the ancestors that would
+    // be left without values or other children
+    void prune(const_iterator iter) {
+        iter.materialize();
 
-    search_iterator find(const key_string& key) const {
-        auto key_iter = key.cbegin();
-        auto node = top_;
+        const auto& path = iter.path_;
+        size_t depth = path.size() - 1;
 
-        while (key_iter != key.cend()) {
-            auto found = node->find_by_key(*key_iter);
+        while (depth > 0) {
+            const auto& parent = nodes_[path[depth - 1].node_];
 
-            if (found == node->children_.end()) {
-                return end();
+            if (parent.value_ != no_node || parent.children_.size() > 1) {
+                break;
             }
+            --depth;
+        }
+
+        node_id parent = depth == 0 ? top_id : path[depth - 1].node_;
+        nodes_[parent].children_.remove(blocks_,
+                                         nodes_[path[depth].node_].key_);
+        release_subtree(path[depth].node_);
+        lower_heights(path, depth);
+    }
 
-            if ((*found)->is_leaf_ && key_iter == key.cend() - 1) {
-                return search_iterator(*found);
+    // Where locate found or made the node for a key. The first depth_
+    // chars of the key were already stored, and any nodes below parent_
+    // on the way to node_ were made by this call.
+    struct placement {
+        node_id node_;
+        node_id parent_;
+        size_t depth_;
+    };
+
+    // Node for key, creating the missing ones. Subtree heights above the
+    // new nodes are left to commit, so that nothing has to be undone if
+    // the value fails to construct.
+    placement locate(key_view key) {
+        check_key(key);
+
+        ensure_root();
+
+        node_id node = top_id;
+        size_t depth = 0;
+
+        for (; depth < key.size(); ++depth) {
+            auto found = nodes_[node].children_.find(key[depth]);
+            if (found == no_node) {
+                break;
             }
+            node = found;
+        }
+
+        placement place{node, node, depth};
+
+        try {
+            for (; depth < key.size(); ++depth) {
+                auto new_child = create_node(place.node_, key[depth]);
 
-            node = (*found);
-            ++key_iter;
+                try {
+                    nodes_[place.node_].children_.insert(blocks_, key[depth],
+                                                         new_child);
+                } catch (...) {
+                    release_subtree(new_child);
+                    throw;
+                }
+                raise_height(new_child, key.size() - depth - 1);
+                place.node_ = new_child;
+            }
+        } catch (...) {
+            abandon(key, place);
+            throw;
         }
 
-        return end();
+        return place;
     }
 
-    bool get_value(const key_string& prefix, T& container) const {
-        auto found_iter = find(prefix);
+    // Raises the heights of the nodes that were already stored
+    void commit(key_view key, const placement& place) {
+        if (place.node_ == place.parent_) {
+            return;
+        }
 
-        if (found_iter == end()) {
-            return false;
+        node_id node = top_id;
+        for (size_t depth = 0; ; ++depth) {
+            raise_height(node, key.size() - depth);
+            if (depth == place.depth_) {
+                break;
+            }
+            node = nodes_[node].children_.find(key[depth]);
         }
+    }
 
-        container = found_iter.value();
+    // Releases the nodes locate made
+    void abandon(key_view key, const placement& place) {
+        if (place.node_ == place.parent_) {
+            return;
+        }
 
-        return true;
+        auto& children = nodes_[place.parent_].children_;
+        auto first = children.find(key[place.depth_]);
+
+        children.remove(blocks_, key[place.depth_]);
+        release_subtree(first);
     }
 
-    search_iterator find_longest_prefix() const {
-        size_t max_length = 0;
-        auto long_iter = end();
+    // Iterator to id for friends that walk nodes_ themselves. Without
+    // parent links the path is rebuilt through parent_of(id).
+    template <class ParentOf>
+    const_iterator iterator_to(node_id id, ParentOf parent_of) const {
+        const_iterator iter(this, id);
+
+#ifdef TRIE_NO_PARENT_LINKS
+        for (; id != top_id; id = parent_of(id)) {
+            iter.push_step(id, no_node);
+        }
+        std::reverse(iter.path_.begin(), iter.path_.end());
+        std::reverse(iter.key_.begin(), iter.key_.end());
+#else
+        static_cast<void>(parent_of);
+#endif
 
-        for (auto iter = begin(); iter != end(); ++iter) {
-            size_t length = iter.key().size();
+        return iter;
+    }
 
-            if (length > max_length) {
-                max_length = length;
-                long_iter = iter;
-            }
+    // Drops the nodes locate made if the value fails to construct
+    template <class... Args>
+    void emplace_value(key_view key, const placement& place,
+                       Args&&... args) {
+        try {
+            assign_value(place.node_, std::forward<Args>(args)...);
+        } catch (...) {
+            abandon(key, place);
+            throw;
         }
 
-        return long_iter;
+        commit(key, place);
     }
 };
 
-template < typename T, typename KeyType >
-void swap(trie<T, KeyType>& lhs, trie<T, KeyType>& rhs) {
+template < typename T, typename KeyType, typename Allocator >
+void swap(trie<T, KeyType, Allocator>& lhs, trie<T, KeyType, Allocator>& rhs) {
     lhs.swap(rhs);
 }
 
+namespace pmr {
+template < typename T, typename KeyType = wchar_t >
+using trie = ::trie<T, KeyType, std::pmr::polymorphic_allocator<T>>;
+}  // namespace pmr
+
+#if __cplusplus > 201703L
+// Entries and the pairs they convert to read the same element, which the
+// range concepts check through a common reference
+template <class KeyType, class Value, template <class> class EntryQual,
+          template <class> class PairQual>
+struct std::basic_common_reference<
+    trie_detail::entry<KeyType, Value>,
+    std::pair<std::basic_string<KeyType>, std::remove_const_t<Value>>,
+    EntryQual, PairQual> {
+    using type =
+        std::pair<std::basic_string<KeyType>, std::remove_const_t<Value>>;
+};
+
+template <class KeyType, class Value, template <class> class PairQual,
+          template <class> class EntryQual>
+struct std::basic_common_reference<
+    std::pair<std::basic_string<KeyType>, std::remove_const_t<Value>>,
+    trie_detail::entry<KeyType, Value>,
+    PairQual, EntryQual> {
+    using type =
+        std::pair<std::basic_string<KeyType>, std::remove_const_t<Value>>;
+};
+
+static_assert(std::bidirectional_iterator<trie<int, char>::iterator>);
+static_assert(std::bidirectional_iterator<trie<int, char>::const_iterator>);
+#endif
+
 #endif // INCLUDE_TRIE_HPP_